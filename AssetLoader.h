@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background asset loading. Jobs (file IO, OBJ import, image decode) run on a
+// pool of worker threads and return an AssetUpload: a closure that moves the
+// finished CPU-side buffers into GL objects. Uploads travel back through a
+// lock-free queue and are run by the GL thread in pump(), a bounded number of
+// bytes per frame, so loading never stalls the render loop for long.
+
+// Bounded multi-producer/multi-consumer queue (Dmitry Vyukov's design). Each
+// cell carries a sequence number that tells producers and consumers whether
+// it is free or filled for their ticket, so push/pop are one CAS each and
+// never take a lock.
+template <typename T>
+class LockFreeQueue
+{
+public:
+    // capacity is rounded up to a power of two.
+    explicit LockFreeQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mMask = size - 1;
+        mCells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Returns false if the queue is full.
+    bool push(T &&value)
+    {
+        size_t pos = mEnqueue.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &mCells[pos & mMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (mEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = mEnqueue.load(std::memory_order_relaxed);
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty.
+    bool pop(T &value)
+    {
+        size_t pos = mDequeue.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &mCells[pos & mMask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (mDequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = mDequeue.load(std::memory_order_relaxed);
+        }
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> mCells;
+    size_t mMask = 0;
+    alignas(64) std::atomic<size_t> mEnqueue{0};
+    alignas(64) std::atomic<size_t> mDequeue{0};
+};
+
+// GL-side half of a loaded asset. upload runs on the GL thread; bytes is what
+// it transfers to the GPU and is charged against the per-frame budget.
+struct AssetUpload
+{
+    std::function<void()> upload;
+    size_t bytes = 0;
+};
+
+class AssetLoader
+{
+public:
+    using Job = std::function<AssetUpload()>;
+
+    AssetLoader() : mReady(256) {}
+    ~AssetLoader() { stop(); }
+
+    // Starts threadCount workers (0: one per hardware thread, minus the GL thread).
+    void start(unsigned threadCount = 0)
+    {
+        if (!mWorkers.empty())
+            return;
+        if (threadCount == 0)
+            threadCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        mStopping = false;
+        for (unsigned i = 0; i < threadCount; i++)
+            mWorkers.emplace_back([this]
+                                  { workerLoop(); });
+    }
+
+    // Joins the workers. Jobs not yet started are dropped, and uploads not yet
+    // pumped are destroyed without running (their buffers are still freed).
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+            mJobs.clear();
+        }
+        mWake.notify_all();
+        for (std::thread &worker : mWorkers)
+            worker.join();
+        mWorkers.clear();
+        AssetUpload dropped;
+        while (mReady.pop(dropped))
+            ;
+        mPending = 0;
+    }
+
+    void submit(Job job)
+    {
+        mPending++;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back(std::move(job));
+        }
+        mWake.notify_one();
+    }
+
+    // GL thread: runs finished uploads until byteBudget is spent. At least
+    // one upload runs per call, so an asset larger than the budget still
+    // arrives. Returns the bytes uploaded.
+    size_t pump(size_t byteBudget)
+    {
+        size_t spent = 0;
+        AssetUpload item;
+        while ((spent == 0 || spent < byteBudget) && mReady.pop(item))
+        {
+            if (item.upload)
+                item.upload();
+            spent += std::max<size_t>(item.bytes, 1);
+            item = AssetUpload();
+            mPending--;
+        }
+        return spent;
+    }
+
+    // True once every submitted job has been uploaded.
+    bool idle() const { return mPending.load() == 0; }
+
+private:
+    void workerLoop()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWake.wait(lock, [this]
+                           { return mStopping || !mJobs.empty(); });
+                if (mStopping)
+                    return;
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+            AssetUpload result = job();
+            while (!mReady.push(std::move(result)))
+            {
+                if (mStopping)
+                    return;
+                std::this_thread::yield(); // GL thread is behind; wait for room
+            }
+        }
+    }
+
+    std::vector<std::thread> mWorkers;
+    std::deque<Job> mJobs; // workers sleep on mWake, so this side keeps a mutex
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::atomic<bool> mStopping{false};
+    std::atomic<int> mPending{0};
+    LockFreeQueue<AssetUpload> mReady;
+};
@@ -8,6 +8,10 @@
 #include <fstream>
 #include <sstream>
 #include <list>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #define GLEW_STATIC 1
 #include <GL/glew.h>
@@ -17,11 +21,33 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// stb_image allocates pixels and decoder scratch from a pool, so decoding a
+// set of textures reuses buffers instead of mapping fresh pages per image
+#include "BufferPool.h"
+BufferPool pixelPool;
+#define STBI_MALLOC(size) pixelPool.allocate(size)
+#define STBI_REALLOC(block, size) pixelPool.reallocate(block, size)
+#define STBI_FREE(block) pixelPool.release(block)
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
 #include "OBJloader.h"
 #include "OBJloaderV2.h"
+#include "OBJloaderV3.h"
+#include "IndexedMesh.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "AssetLoader.h"
+#include "ContentCache.h"
+#include "UploadRing.h"
+#include "ShaderBuilder.h"
+#include "ShaderPermutations.h"
+#include "ProgramReflection.h"
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include "FrustumCull.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -37,6 +63,49 @@ using namespace std;
 // ------------------------------------
 const GLuint WIDTH = 1200, HEIGHT = 800;
 const int MAX_FIREBALLS = 32;
+// Store imported meshes as 16-byte quantized vertices instead of 32-byte floats
+const bool useQuantizedVertices = true;
+// LOD selection: allowed geometric error on screen, and how far below it a
+// coarser level must fall before it is picked (keeps levels from flickering)
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.7f;
+// Bytes of finished assets the GL thread uploads per frame while loading
+const size_t ASSET_UPLOAD_BUDGET = 8u << 20;
+// Assimp post-processing applied on import (see importProfileFlags)
+enum ImportProfile
+{
+    IMPORT_FAST,     // triangulate only; welding and cache order are ours
+    IMPORT_BALANCED, // + JoinIdenticalVertices, SortByPType
+    IMPORT_QUALITY,  // + ImproveCacheLocality, OptimizeMeshes
+};
+const ImportProfile importProfile = IMPORT_FAST;
+// Upload textures block-compressed (BC1 opaque, BC7 or BC3 with alpha) from a
+// <image>.ktx cache built on first load
+const bool useCompressedTextures = true;
+// Filter for the mip chains built into the texture cache
+const MipFilter textureMipFilter = MIP_FILTER_KAISER;
+// Material textures are layers of one texture array, each resized to this
+// square size when cooked into its <image>.layer.ktx cache
+const uint32_t MATERIAL_LAYER_SIZE = 512;
+const int MATERIAL_LAYERS = 16; // layer 0 is the grey placeholder
+const int MAX_MATERIALS = 64;   // MAX_MATERIALS in scene_fragment_textured.glsl
+// Stream material layers in: a layer arrives with only its levels of at most
+// TEXTURE_STREAM_TAIL_SIZE, and finer ones follow under a per-frame byte
+// budget as draws need them, largest on screen first
+const bool useTextureStreaming = true;
+const uint32_t TEXTURE_STREAM_TAIL_SIZE = 32;
+const size_t TEXTURE_STREAM_BUDGET = 256u << 10;
+// Staging ring that texture and uniform buffer uploads go through
+const size_t UPLOAD_RING_BYTES = 4u << 20;
+// Uniform block binding points, fixed for every program
+const GLuint MATERIAL_BLOCK_BINDING = 0;
+const GLuint FRAME_BLOCK_BINDING = 1;
+const GLuint LIGHT_BLOCK_BINDING = 2;
+// Shadow map taps in scene shader variants with shadows (9: 3x3 PCF)
+const int SHADOW_PCF_TAPS = 9;
+// Save linked programs with glGetProgramBinary next to their shaders and
+// restore them on later runs instead of compiling the GLSL again
+const bool useProgramCache = true;
 
 // ------------------------------------
 // Globals
@@ -80,9 +149,32 @@ float hitFlashDuration = 0.3f;
 vec3 lightPos = vec3(10.0f, 10.0f, 10.0f);
 vec3 lightColor = vec3(0.15f, 0.15f, 0.15f); // very dim sun for cave atmosphere
 
-// Shader programs
-GLuint sceneShaderProgram;
-GLuint shadowShaderProgram;
+// Uniform handles, resolved once after the programs link; the render code
+// below never looks a uniform up by name
+struct SceneUniforms
+{
+    Mat4Uniform model;
+    Mat3Uniform normalMatrix;
+    BoolUniform octNormals;
+    IntUniform material;
+    Sampler2DArrayUniform materialTextures;
+    Sampler2DUniform shadowMap;
+};
+
+// Shader programs. The scene shader is built once per feature mask
+// (ShaderPermutations.h); each draw uses the variant its material needs.
+struct SceneVariant
+{
+    GLuint program = 0;
+    SceneUniforms uniforms;
+};
+SceneVariant sceneVariants[SHADER_VARIANT_COUNT];
+GLuint shadowShaderProgram, shadowInstancedProgram;
+
+struct ShadowUniforms
+{
+    Mat4Uniform model;
+} shadowUniforms;
 
 // Shadow mapping
 GLuint depthMapFBO;
@@ -91,6 +183,7 @@ const unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
 
 // Ground
 GLuint groundVAO = 0, groundVBO = 0;
+const Bounds groundBounds = boundsFromBox(vec3(-50.0f, 0.0f, -50.0f), vec3(50.0f, 0.0f, 50.0f));
 
 // Cube (kept for testing)
 GLuint cubeVAO = 0, cubeVBO = 0;
@@ -98,25 +191,268 @@ GLuint cubeVAO = 0, cubeVBO = 0;
 // Geodesic dome (hemisphere)
 GLuint domeVAO = 0, domeVBO = 0, domeEBO = 0;
 int domeIndexCount = 0;
-GLuint domeTexture = 0;
+int domeMaterial = 0; // ground and dome
+Bounds domeBounds;    // hemisphere above its center, set with the mesh
 
 // Fixed world position (don't center on camera) - lowered dome to ground level
 glm::vec3 domeCenter = glm::vec3(0.0f, -11.0f, 0.0f);
 
-// Sphere for fireballs
-GLuint sphereVAO = 0, sphereVBO = 0;
-int sphereVertexCount = 0;
+// Fireballs draw as ray-traced sphere impostors (fireball_*.glsl), all live
+// projectiles in one instanced draw. Per-instance attributes:
+struct FireballInstance
+{
+    vec3 position;
+    float radius;
+    float phase; // radians, offsets the pulse and flicker
+};
+static_assert(sizeof(FireballInstance) == 20, "FireballInstance must match the tightly packed attribute layout");
+const float FIREBALL_RADIUS = 0.2f;
+GLuint fireballShaderProgram;
+struct FireballUniforms
+{
+    IntUniform material;
+} fireballUniforms;
+GLuint fireballVAO = 0, fireballQuadVBO = 0, fireballInstanceVBO = 0;
+size_t fireballCapacity = 0; // FireballInstance records allocated
+size_t fireballsDrawn = 0;
+
+// The frame is submitted as draw packets to a render queue (RenderQueue.h),
+// sorted, and executed by executeDraw() through glState, which drops state
+// changes that would not change anything (GLStateCache.h).
+enum DrawKind
+{
+    DRAW_SCENE,    // a scene shader variant
+    DRAW_SHADOW,   // shadow map depth (plain or instanced program)
+    DRAW_FIREBALLS // fireball impostors
+};
+struct DrawCommand
+{
+    DrawKind kind = DRAW_SCENE;
+    uint32_t features = 0; // DRAW_SCENE: variant
+    GLuint program = 0;    // DRAW_SHADOW: program
+    int material = 0;
+    mat4 model = mat4(1.0f); // object to world, unused by instanced draws
+    mat4 dequantize = mat4(1.0f);
+    bool octNormals = false;
+    // geometry
+    GLuint vao = 0;
+    GLenum mode = GL_TRIANGLES;
+    GLsizei count = 0;
+    GLenum indexType = 0;  // 0: glDrawArrays from vertex first
+    uintptr_t first = 0;   // first vertex, or byte offset of the first index
+    GLsizei instances = 0; // > 0: instanced draw
+    GLint firstInstance = 0; // record in instanceVBO (model instances)
+    // state
+    bool cullFace = false;
+    bool depthWrite = true;
+};
+RenderQueue<DrawCommand> renderQueue;
+GLStateCache glState;
+size_t renderPackets = 0; // executed last frame
+
+// Frustum culling (FrustumCull.h): the camera's frustum for the scene pass,
+// the light's ortho box for the shadow map, both set at the start of a
+// frame. Culled draws are never queued.
+Frustum sceneFrustum, shadowFrustum;
+CullStats sceneCullStats, shadowCullStats; // this frame
 
 // Dragon models
+struct ModelBatch
+{
+    MeshRange lods[MESH_CACHE_MAX_LODS]; // this batch's part of each level
+    int material = -1;                   // -1: the model's material
+};
+
 struct DragonModel
 {
-    GLuint VAO = 0, VBO = 0;
-    vector<vec3> vertices;
-    vector<vec3> normals;
-    vector<vec2> uvs;
-    GLuint texture = 0;
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    GLsizei vertexCount = 0;
+    GLsizei indexCount = 0;
+    GLenum indexType = GL_UNSIGNED_INT; // GL_UNSIGNED_SHORT when the mesh has < 64k vertices
+    Bounds bounds;                // object space (stored positions dequantized)
+    mat4 dequantize = mat4(1.0f); // stored positions -> object space (identity for float meshes)
+    bool octNormals = false;      // normals stored octahedral-encoded
+    vector<MeshLod> lods;         // index ranges, finest first; error in object units
+    vector<ModelBatch> batches;   // one draw per material in the scene pass
+    int material = 0;             // used by batches without a texture of their own
+    uint64_t meshKey = 0;         // modelMeshCache entry holding the buffers (0: not shared)
 };
 
+// How a view turns object-space error into pixels: perspective views divide by
+// distance to the eye, orthographic ones (the shadow map) do not.
+struct LodView
+{
+    vec3 eye;
+    float pixelsPerUnit; // at distance 1 for perspective
+    bool orthographic;
+};
+
+// Triangles submitted this frame vs. what LOD 0 everywhere would have cost
+size_t lodTrianglesDrawn = 0;
+size_t lodTrianglesFull = 0;
+size_t modelDrawCalls = 0;
+size_t instancesDrawn = 0;
+
+// Per-instance attributes of instanced model draws: locations 3-6 (model)
+// and 7-9 (normal matrix) of the INSTANCED scene and shadow vertex shaders
+struct InstanceData
+{
+    mat4 model;        // includes the mesh dequantization
+    mat3 normalMatrix; // inverse-transpose of the model matrix without it
+};
+static_assert(sizeof(InstanceData) == 100, "InstanceData must match the tightly packed attribute layout");
+const GLuint INSTANCE_MODEL_LOCATION = 3;
+const GLuint INSTANCE_NORMAL_LOCATION = 7;
+
+// Every instance drawn in a frame lives in one buffer, which every model VAO
+// reads its instance attributes from
+GLuint instanceVBO = 0;
+size_t instanceCapacity = 0; // InstanceData records allocated
+
+// Instances drawn at one LOD: one instanced draw per material batch
+struct InstanceRun
+{
+    int lod;
+    GLint first;        // record in instanceVBO
+    GLsizei count;
+    float screenPixels; // largest on-screen size in the run (scene pass)
+    float depth;        // nearest instance's distance from the eye (or light)
+};
+
+// Asset loading: workers decode/import, the GL thread uploads in pump()
+AssetLoader assetLoader;
+DragonModel placeholderModel; // shares its buffers with models still loading
+// Compressed formats the driver can sample; set once after glewInit
+bool supportsS3TC = false, supportsBPTC = false;
+
+// CPU-side image: stb_image pixels, or a full mip chain (cached.header set)
+// from a mapped texture cache file or one built in memory. Frees the pixels
+// with the last reference.
+struct DecodedImage
+{
+    unsigned char *pixels = nullptr;
+    int width = 0, height = 0, channels = 0;
+    TextureCacheFile cacheFile;
+    vector<char> cacheImage;
+    TextureCacheView cached;
+    ~DecodedImage()
+    {
+        if (pixels)
+            stbi_image_free(pixels);
+    }
+};
+
+// Per-material parameters, std140 layout of Material in
+// scene_fragment_textured.glsl
+struct MaterialData
+{
+    vec4 baseColor = vec4(1.0f); // rgb multiplies the texel
+    vec4 emissive = vec4(0.0f);  // rgb added after lighting
+    vec4 hitFlash = vec4(0.0f);  // rgb color, a strength
+    GLint layer[4] = {0, 0, 0, 0}; // [0]: layer in materialArray, [1]: its finest resident level
+};
+static_assert(sizeof(MaterialData) == 64, "MaterialData must match the std140 Material struct");
+
+// Per-frame constants, std140 layout of FrameBlock in the scene and shadow
+// shaders. A vec3 followed by a float shares one 16-byte slot.
+struct FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceMatrix; // sun shadow map
+    vec3 viewPos;
+    float time;            // seconds since startup
+    vec3 lightPos;         // sun
+    float deltaTime;
+    vec4 lightColor;       // rgb
+};
+static_assert(offsetof(FrameData, projection) == 64 && offsetof(FrameData, lightSpaceMatrix) == 128 &&
+                  offsetof(FrameData, viewPos) == 192 && offsetof(FrameData, time) == 204 && offsetof(FrameData, lightPos) == 208 &&
+                  offsetof(FrameData, deltaTime) == 220 && offsetof(FrameData, lightColor) == 224 && sizeof(FrameData) == 240,
+              "FrameData must match the std140 FrameBlock");
+
+// Point lights (the staff glow and the fireballs), std140 layout of
+// LightBlock in scene_fragment_textured.glsl
+struct FireballLightData
+{
+    vec4 position; // xyz
+    vec4 color;    // rgb
+};
+struct LightData
+{
+    FireballLightData fireballs[MAX_FIREBALLS];
+    GLint fireballCount;
+    float fireballRadius; // falloff distance scale
+    float padding[2];
+};
+static_assert(sizeof(FireballLightData) == 32 && offsetof(LightData, fireballCount) == 32 * MAX_FIREBALLS &&
+                  offsetof(LightData, fireballRadius) == 32 * MAX_FIREBALLS + 4 && sizeof(LightData) == 32 * MAX_FIREBALLS + 16,
+              "LightData must match the std140 LightBlock");
+
+// Materials: every scene texture is a layer of materialArray and every
+// material an entry of materialUBO, so a frame binds both once and a draw
+// only sets uMaterial. GL thread only.
+vector<MaterialData> materials;
+bool materialsDirty = true;
+GLuint materialUBO = 0, materialArray = 0;
+uint32_t materialArrayFormat = TEXTURE_CACHE_RGBA8;
+
+// Frame and light blocks: filled once per frame in main and bound to their
+// fixed binding points for every program
+FrameData frameData;
+LightData lightData;
+GLuint frameUBO = 0, lightUBO = 0;
+int fireballMaterial = 0;
+
+// A texture to load into a material's layer
+struct TextureRequest
+{
+    int material;
+    string path;
+};
+
+// GPU buffers of a procedural mesh
+struct ProceduralMesh
+{
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    int indexCount = 0;
+};
+
+// Content-addressed sharing: identical sources resolve to one GL object.
+// Keys are XXH64 of the file bytes (textures, models + cache flags) or of the
+// generator name and parameters (procedural meshes).
+ContentCache<int> layerCache;
+ContentCache<DragonModel> modelMeshCache;
+ContentCache<ProceduralMesh> proceduralMeshCache;
+uint64_t layerKeys[MATERIAL_LAYERS] = {}; // GL thread only, for releaseLayer
+vector<int> freeLayers;
+
+// Residency of a material layer: levels residentLevel and coarser are in the
+// array; image holds the cooked levels still to stream in (null once level 0
+// is resident).
+struct LayerStream
+{
+    shared_ptr<DecodedImage> image;
+    int residentLevel = 0;
+    float screenPixels = 0.0f; // largest on-screen size of one texture repeat this frame
+};
+LayerStream layerStreams[MATERIAL_LAYERS];
+size_t textureStreamBytes = 0; // finer levels uploaded on demand
+
+// Persistently mapped with ARB_buffer_storage, so workers can stage layer
+// images straight into it; orphaned on wrap otherwise
+UploadRing uploadRing;
+uint64_t domeMeshKey = 0;                    // procedural mesh behind the dome globals
+
+// Decoded images shared by in-flight requests for the same content
+struct DecodeSlot
+{
+    mutex lock;
+    weak_ptr<DecodedImage> image;
+};
+mutex decodeSlotsMutex;
+unordered_map<uint64_t, shared_ptr<DecodeSlot>> decodeSlots;
+
 DragonModel dragonHead;
 DragonModel fishBody;
 DragonModel bearPaw;   // (unused in this file but kept for parity)
@@ -130,8 +466,13 @@ struct SnakeNeckSegment
     vec3 position;
     vec3 rotation;
     float animationPhase;
+    int lod = 0;       // current level in the scene pass
+    int shadowLod = 0; // current level in the shadow pass
 };
 vector<SnakeNeckSegment> snakeNeckSegments(SNAKE_NECK_SEGMENTS);
+// Neck segment instances for each pass, refreshed by updateSnakeInstances()
+vector<InstanceRun> snakeSceneRuns, snakeShadowRuns;
+int headLod = 0, headShadowLod = 0;
 vec3 snakeBasePos = vec3(0.0f, 0.0f, -8.0f); // spawn snake inside dome
 float snakeAnimationTime = 0.0f;
 
@@ -163,77 +504,148 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode);
 
 GLuint loadTexture(const char *path);
+shared_ptr<DecodedImage> decodeImage(const char *path);
+shared_ptr<DecodedImage> loadTextureImage(const char *path, uint64_t sourceHash, uint32_t layerSize = 0);
+GLuint uploadTexture(const DecodedImage &image, GLuint textureID = 0);
+struct MaterialData;
+int createMaterial(const MaterialData &material);
+void setupMaterials();
+void bindMaterials();
+void uploadBuffer(GLenum target, GLuint buffer, const void *data, size_t bytes);
+void setupFrameBlocks();
+void updateFrameBlocks();
+void setMaterialHitFlash(const DragonModel &model, vec3 color, float strength);
+void requestTexture(int material, const char *path);
+struct TextureRequest;
+void requestTextures(const vector<TextureRequest> &requests);
+shared_ptr<DecodedImage> decodeImageShared(uint64_t key, const char *path);
+int acquireLayer(uint64_t key, shared_ptr<DecodedImage> image, const char *path, const UploadSpan *staged = nullptr);
+void releaseLayer(int layer);
+void noteTextureCoverage(int material, float screenPixels);
+void printUploadRingStats();
+void streamMaterialLayers(size_t byteBudget);
+void releaseDragonModel(DragonModel &model);
+uint64_t proceduralMeshKey(const char *generator, const float *params, size_t count);
+bool useDomeMesh(uint64_t key);
+void releaseProceduralMesh(uint64_t key);
+void setupPlaceholders();
 GLuint createShaderProgram(const char *vertexPath, const char *fragmentPath);
 void setupShadowMapping();
 void setupGround();
-void renderGround(GLuint shaderProgram, mat4 model, mat4 view, mat4 projection);
+void renderGround(mat4 model, mat4 view, mat4 projection);
 void setupCube();
-void setupSphere();
-bool loadDragonModel(DragonModel &model, const char *objPath, const char *texturePath);
+void setupFireballs();
+void renderFireballs();
+struct LoadedMesh;
+bool loadMeshCache(const char *objPath, LoadedMesh &out);
+void requestDragonModel(DragonModel &model, const char *objPath);
+unsigned importProfileFlags(ImportProfile profile);
+bool importDragonMesh(const char *objPath, IndexedMesh &mesh, ImportProfile profile = importProfile);
+void uploadMeshCache(DragonModel &model, const MeshCacheHeader *cache);
+void requestBatchTextures(DragonModel &model, const MeshCacheHeader *cache);
+bool cullTest(const Frustum &frustum, CullStats &stats, const Bounds &bounds, const mat4 &model);
+DrawCommand dragonModelDraw(const DragonModel &model, int lod = 0, int batch = -1, GLsizei instances = 0, GLint firstInstance = 0);
+void submitSceneDraw(DrawCommand command, uint32_t features, int material, uint32_t pass, float depth);
+void submitShadowDraw(DrawCommand command, GLuint program, float depth);
+void executeDraw(const DrawCommand &command);
+void beginRenderPass(uint32_t pass);
+void flushRenderQueue();
+void reserveInstances(size_t count);
+void bindInstanceAttributes(GLint first);
+int selectLod(const DragonModel &model, const mat4 &modelMatrix, const LodView &lodView, int currentLod);
+float modelPixelsPerUnit(const DragonModel &model, const mat4 &modelMatrix, const LodView &lodView);
+void setupShaderVariants();
+uint32_t materialFeatures(int material);
+void setModelUniforms(SceneUniforms &uniforms, const mat4 &model, const mat4 &dequantize = mat4(1.0f), bool octNormals = false);
 void setupSnakeModels();
 void updateSnakeAnimation(float deltaTime, vec3 cameraPos);
 bool checkCollision(vec3 projectilePos, vec3 segmentPos, float radius);
 void playHitSound();
-void renderDragonModel(DragonModel &model, GLuint shaderProgram, mat4 modelMatrix, mat4 view, mat4 projection, mat4 lightSpaceMatrix);
-void renderSnake(GLuint shaderProgram, mat4 view, mat4 projection, mat4 lightSpaceMatrix);
-void renderStaff(GLuint shaderProgram, mat4 view, mat4 projection, mat4 lightSpaceMatrix);
+void renderDragonModel(DragonModel &model, mat4 modelMatrix, mat4 view, mat4 projection, int lod = 0);
+void renderDragonModelInstanced(DragonModel &model, const InstanceRun &run);
+void updateSnakeInstances(const LodView &sceneLodView, const LodView &shadowLodView);
+void renderSnake(mat4 view, mat4 projection, const LodView &lodView);
+void renderStaff(mat4 view, mat4 projection);
 void setupDome();
 void renderDome();
 void setupDomeGeodesic();
 void renderDomeGeodesic();
 
-string loadShaderSource(const char *filename)
+// Uploads the object transform for the scene shader. dequantize maps a mesh's
+// stored positions to object space and is folded into "model"; the normal
+// matrix is built from the object's model matrix alone, once per draw instead
+// of once per vertex.
+void setModelUniforms(SceneUniforms &uniforms, const mat4 &model, const mat4 &dequantize, bool octNormals)
 {
-    ifstream file(filename);
-    if (!file.is_open())
-    {
-        cout << "ERROR: Unable to read shader file " << filename << endl;
-        return "";
-    }
-    stringstream ss;
-    ss << file.rdbuf();
-    return ss.str();
+    uniforms.model.set(model * dequantize);
+    uniforms.normalMatrix.set(transpose(inverse(mat3(model))));
+    uniforms.octNormals.set(octNormals);
 }
 
-GLuint compileShader(GLenum type, const string &source)
+// Binds the uniform blocks of every program and resolves their uniform
+// handles; call once they have linked. Samplers use fixed units (material
+// array 0, shadow map 1) and are set here for good.
+void setupShaderVariants()
 {
-    GLuint shader = glCreateShader(type);
-    const char *src = source.c_str();
-    glShaderSource(shader, 1, &src, NULL);
-    glCompileShader(shader);
-    GLint success;
-    GLchar infoLog[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    for (SceneVariant &variant : sceneVariants)
     {
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        cout << "ERROR: Shader compilation failed\n"
-             << infoLog << endl;
+        GLuint program = variant.program;
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "MaterialBlock"), MATERIAL_BLOCK_BINDING);
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameBlock"), FRAME_BLOCK_BINDING);
+        GLuint lightBlock = glGetUniformBlockIndex(program, "LightBlock");
+        if (lightBlock != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, lightBlock, LIGHT_BLOCK_BINDING);
+
+        ProgramReflection scene;
+        scene.reflect(program);
+        SceneUniforms &u = variant.uniforms;
+        u.model = scene.get<Mat4Uniform>("model");
+        u.normalMatrix = scene.get<Mat3Uniform>("normalMatrix");
+        u.octNormals = scene.get<BoolUniform>("uOctNormals");
+        u.material = scene.get<IntUniform>("uMaterial");
+        u.materialTextures = scene.get<Sampler2DArrayUniform>("materialTextures");
+        u.shadowMap = scene.get<Sampler2DUniform>("shadowMap");
+        glUseProgram(program);
+        u.materialTextures.set(0);
+        u.shadowMap.set(1);
     }
-    return shader;
+    glUseProgram(0);
+
+    for (GLuint program : {shadowShaderProgram, shadowInstancedProgram, fireballShaderProgram})
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameBlock"), FRAME_BLOCK_BINDING);
+    glUniformBlockBinding(fireballShaderProgram, glGetUniformBlockIndex(fireballShaderProgram, "MaterialBlock"), MATERIAL_BLOCK_BINDING);
+    ProgramReflection shadow;
+    shadow.reflect(shadowShaderProgram);
+    shadowUniforms.model = shadow.get<Mat4Uniform>("model");
+    ProgramReflection fireball;
+    fireball.reflect(fireballShaderProgram);
+    fireballUniforms.material = fireball.get<IntUniform>("uMaterial");
 }
 
+// Features a draw with material uses: lighting (shadows and point lights)
+// only for surfaces that reflect light, which leaves out the pure emissive
+// fireball core; emissive and hit flash only while they add color. The
+// result is the same image the full shader would draw.
+uint32_t materialFeatures(int material)
+{
+    const MaterialData &data = materials[material];
+    uint32_t features = 0;
+    if (data.baseColor.r > 0.0f || data.baseColor.g > 0.0f || data.baseColor.b > 0.0f)
+        features |= SHADER_SHADOWS | SHADER_POINT_LIGHTS;
+    if (data.emissive.r != 0.0f || data.emissive.g != 0.0f || data.emissive.b != 0.0f)
+        features |= SHADER_EMISSIVE;
+    if (data.hitFlash.a > 0.0f && (data.hitFlash.r != 0.0f || data.hitFlash.g != 0.0f || data.hitFlash.b != 0.0f))
+        features |= SHADER_HIT_FLASH;
+    return features;
+}
+
+// Builds one program on its own, waiting for it. Startup submits all of its
+// programs to one ShaderBuilder instead so the driver compiles them together.
 GLuint createShaderProgram(const char *vertexPath, const char *fragmentPath)
 {
-    string vertexSource = loadShaderSource(vertexPath);
-    string fragmentSource = loadShaderSource(fragmentPath);
-    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
-    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-    GLint success;
-    GLchar infoLog[512];
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        cout << "ERROR: Shader program linking failed\n"
-             << infoLog << endl;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    ShaderBuilder builder(useProgramCache);
+    GLuint program = builder.submit(vertexPath, fragmentPath);
+    builder.finish();
     return program;
 }
 
@@ -243,81 +655,643 @@ GLuint createShaderProgram(const char *vertexPath, const char *fragmentPath)
 class Projectile
 {
 public:
-    Projectile(vec3 position, vec3 velocity) : mPosition(position), mVelocity(velocity) {}
+    Projectile(vec3 position, vec3 velocity, float radius = FIREBALL_RADIUS)
+        : mPosition(position), mVelocity(velocity), mRadius(radius), mPhase(nextPhase()) {}
     void Update(float dt) { mPosition += mVelocity * dt; }
 
-    void Draw(GLuint shaderProgram, mat4 view, mat4 projection)
-    {
-        glUseProgram(shaderProgram);
-
-        static float fireballTime = 0.0f;
-        fireballTime += 0.016f;
-        mat4 worldMatrix = translate(mat4(1.0f), mPosition) * rotate(mat4(1.0f), fireballTime * 3.0f, vec3(0.5f, 1.0f, 0.3f)) * scale(mat4(1.0f), vec3(0.2f));
-
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, value_ptr(worldMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, value_ptr(projection));
-
-        // Emissive fireball toggle
-        glUniform1f(glGetUniformLocation(shaderProgram, "isFireball"), 1.0f);
-        glUniform1f(glGetUniformLocation(shaderProgram, "hitFlashStrength"), 0.0f);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glUniform1i(glGetUniformLocation(shaderProgram, "texture_diffuse1"), 0);
-
-        extern GLuint sphereVAO;
-        extern int sphereVertexCount;
-        glBindVertexArray(sphereVAO);
-        glDrawElements(GL_TRIANGLES, sphereVertexCount, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-    }
+    // drawn by renderFireballs()
+    FireballInstance instance() const { return {mPosition, mRadius, mPhase}; }
 
     vec3 getPosition() const { return mPosition; }
 
 private:
+    // golden-angle steps keep consecutive fireballs out of step
+    static float nextPhase()
+    {
+        static float phase = 0.0f;
+        phase = fmodf(phase + 2.39996f, 6.28319f);
+        return phase;
+    }
+
     vec3 mPosition;
     vec3 mVelocity;
+    float mRadius;
+    float mPhase;
 };
 
 // ------------------------------------
 // Assets setup
 // ------------------------------------
-GLuint loadTexture(const char *path)
+// Decodes an image file on any thread; pixels is null if decoding failed.
+shared_ptr<DecodedImage> decodeImage(const char *path)
 {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    int width, height, nrChannels;
+    shared_ptr<DecodedImage> image = make_shared<DecodedImage>();
     cout << "Loading texture: " << path << endl;
-    unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
-    if (data)
+    image->pixels = stbi_load(path, &image->width, &image->height, &image->channels, 0);
+    if (image->pixels)
+        cout << "Texture loaded: " << image->width << "x" << image->height << " ch=" << image->channels << endl;
+    else
+        cout << "FAILED to load texture: " << path << " reason: " << stbi_failure_reason() << endl; // thread-local in stb_image
+    return image;
+}
+
+// Runs copy(source) to upload size bytes at data. The bytes are staged
+// through uploadRing, so source is their offset in it (bound as
+// GL_PIXEL_UNPACK_BUFFER) and the copy does not wait on the transfer; if the
+// ring has no room, source is data and the copy is synchronous.
+template <typename Copy>
+void uploadPixels(const void *data, size_t size, Copy copy)
+{
+    UploadSpan span;
+    if (!uploadRing.stage(data, size, span))
+    {
+        copy(data);
+        return;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadRing.buffer());
+    copy((const void *)(uintptr_t)span.offset);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    uploadRing.issued(span);
+}
+
+// Uploads a decoded image into textureID (a new texture if 0). A failed
+// decode becomes a 1x1 white texture.
+GLuint uploadTexture(const DecodedImage &image, GLuint textureID)
+{
+    if (textureID == 0)
+        glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    if (image.cached.header)
     {
-        GLenum format = (nrChannels == 1 ? GL_RED : (nrChannels == 3 ? GL_RGB : GL_RGBA));
-        cout << "Texture loaded: " << width << "x" << height << " ch=" << nrChannels << endl;
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        const KtxHeader *header = image.cached.header;
+        GLsizei width = header->pixelWidth, height = header->pixelHeight;
+        for (uint32_t level = 0; level < image.cached.levelCount; level++)
+        {
+            uploadPixels(image.cached.levels[level], image.cached.levelBytes[level], [&](const void *source)
+                         {
+                if (header->glInternalFormat == TEXTURE_CACHE_RGBA8)
+                    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, source);
+                else
+                    glCompressedTexImage2D(GL_TEXTURE_2D, level, header->glInternalFormat, width, height, 0,
+                                           image.cached.levelBytes[level], source); });
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.cached.levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    else if (image.pixels)
+    {
+        GLenum format = (image.channels == 1 ? GL_RED : (image.channels == 3 ? GL_RGB : GL_RGBA));
+        uploadPixels(image.pixels, (size_t)image.width * image.height * image.channels, [&](const void *source)
+                     { glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, source); });
         glGenerateMipmap(GL_TEXTURE_2D);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        stbi_image_free(data);
     }
     else
     {
-        cout << "FAILED to load texture: " << path << " reason: " << stbi_failure_reason() << endl;
-        glBindTexture(GL_TEXTURE_2D, textureID);
         unsigned char fallbackData[] = {255, 255, 255};
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, fallbackData);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        stbi_image_free(data);
     }
     return textureID;
 }
 
+// Cache level format for an image: block-compressed if enabled and the GPU
+// can sample it, else RGBA8.
+uint32_t textureCacheFormat(bool hasAlpha)
+{
+    if (!useCompressedTextures || !supportsS3TC)
+        return TEXTURE_CACHE_RGBA8;
+    if (!hasAlpha)
+        return TEXTURE_BC1;
+    return supportsBPTC ? TEXTURE_BC7 : TEXTURE_BC3;
+}
+
+// A cache is reused only in the format that would be built now, so toggling
+// compression or moving to another GPU rebuilds it.
+bool isCurrentTextureCacheFormat(uint32_t format)
+{
+    if (format == TEXTURE_CACHE_RGBA8)
+        return textureCacheFormat(false) == TEXTURE_CACHE_RGBA8;
+    return format == textureCacheFormat(format != TEXTURE_BC1);
+}
+
+// Loads an image and its mip chain for upload on any thread. A valid texture
+// cache (<image>.ktx) is mapped as-is; otherwise the image is decoded, its
+// mips built on the CPU (gamma-correct, textureMipFilter), compressed if
+// enabled, and the cache (re)written for the next run. Grey images skip the
+// cache and keep glGenerateMipmap so they still sample as red.
+// With a layerSize the image is cooked for the material array instead: resized
+// to layerSize x layerSize, opaque, cached as <image>.layer.ktx.
+shared_ptr<DecodedImage> loadTextureImage(const char *path, uint64_t sourceHash, uint32_t layerSize)
+{
+    double startTime = glfwGetTime();
+    string cachePath = layerSize ? string(path) + ".layer.ktx" : textureCachePath(path);
+    const uint32_t flags = textureMipFilter | layerSize << 8;
+    shared_ptr<DecodedImage> image = make_shared<DecodedImage>();
+    if (image->cacheFile.open(cachePath.c_str(), sourceHash, flags) &&
+        isCurrentTextureCacheFormat(image->cacheFile.view.header->glInternalFormat) &&
+        (!layerSize || (image->cacheFile.view.header->glInternalFormat == textureCacheFormat(false) &&
+                        image->cacheFile.view.header->pixelWidth == layerSize && image->cacheFile.view.header->pixelHeight == layerSize)))
+    {
+        image->cached = image->cacheFile.view;
+        cout << "Texture cache hit: " << cachePath << " (" << (glfwGetTime() - startTime) * 1000.0 << " ms)" << endl;
+        return image;
+    }
+
+    image = decodeImage(path);
+    if (!image->pixels || (image->channels < 3 && !layerSize))
+        return image;
+    vector<uint8_t> rgba;
+    expandToRGBA(image->pixels, image->width, image->height, image->channels, rgba);
+    uint32_t width = image->width, height = image->height;
+    if (layerSize && (width != layerSize || height != layerSize))
+    {
+        vector<uint8_t> resized;
+        resizeImage(rgba.data(), width, height, layerSize, layerSize, resized);
+        rgba.swap(resized);
+        width = height = layerSize;
+    }
+    uint32_t format = textureCacheFormat(!layerSize && imageHasAlpha(rgba.data(), width, height));
+    buildTextureCache(rgba.data(), width, height, format, textureMipFilter, sourceHash, image->cacheImage, layerSize << 8);
+    if (!writeCacheFile(cachePath.c_str(), image->cacheImage))
+        cout << "WARNING: Unable to write texture cache " << cachePath << endl;
+    if (validateTextureCache(image->cacheImage.data(), image->cacheImage.size(), sourceHash, flags, image->cached))
+    {
+        stbi_image_free(image->pixels);
+        image->pixels = nullptr;
+    }
+    cout << "Texture cache miss: " << path << " mips" << (format == TEXTURE_CACHE_RGBA8 ? "" : " + compression") << " built in "
+         << (glfwGetTime() - startTime) * 1000.0 << " ms" << endl;
+    return image;
+}
+
+GLuint loadTexture(const char *path)
+{
+    uint64_t sourceHash;
+    if (!hashFile(path, sourceHash))
+        return uploadTexture(*decodeImage(path)); // fails and reports why
+    return uploadTexture(*loadTextureImage(path, sourceHash));
+}
+
+// GPU bytes of an uploaded image: the cached levels, or level 0 plus
+// ~1/3 for the generated mip chain
+size_t textureBytes(const DecodedImage &image)
+{
+    if (image.cached.header)
+        return image.cached.totalBytes();
+    return image.pixels ? (size_t)image.width * image.height * image.channels * 4 / 3 : 3;
+}
+
+// Decodes path, or returns the image another worker already decoded (or is
+// decoding) for the same content hash.
+shared_ptr<DecodedImage> decodeImageShared(uint64_t key, const char *path)
+{
+    shared_ptr<DecodeSlot> slot;
+    {
+        lock_guard<mutex> lock(decodeSlotsMutex);
+        shared_ptr<DecodeSlot> &entry = decodeSlots[key];
+        if (!entry)
+            entry = make_shared<DecodeSlot>();
+        slot = entry;
+    }
+    lock_guard<mutex> lock(slot->lock);
+    shared_ptr<DecodedImage> image = slot->image.lock();
+    if (image)
+        cout << "Texture " << path << " has the same content as one already decoded" << endl;
+    else
+    {
+        image = loadTextureImage(path, key, MATERIAL_LAYER_SIZE);
+        slot->image = image;
+    }
+    return image;
+}
+
+// First level a new layer uploads: the largest at most
+// TEXTURE_STREAM_TAIL_SIZE when streaming, else level 0.
+uint32_t layerTailLevel(const TextureCacheView &cached)
+{
+    uint32_t level = 0;
+    for (uint32_t size = MATERIAL_LAYER_SIZE; useTextureStreaming && size > TEXTURE_STREAM_TAIL_SIZE; size /= 2)
+        level++;
+    return std::min(level, cached.levelCount - 1);
+}
+
+// Bytes of levels firstLevel.. of a cooked image.
+size_t layerLevelBytes(const TextureCacheView &cached, uint32_t firstLevel)
+{
+    size_t bytes = 0;
+    for (uint32_t level = firstLevel; level < cached.levelCount; level++)
+        bytes += cached.levelBytes[level];
+    return bytes;
+}
+
+// Copies levels [firstLevel, endLevel) of a cooked layer image
+// (MATERIAL_LAYER_SIZE square, in materialArrayFormat) into layer of the
+// material array, through the upload ring. staged, if given, already holds
+// those levels back to back in the ring (written by a worker).
+void uploadLayer(const TextureCacheView &cached, int layer, uint32_t firstLevel = 0, uint32_t endLevel = ~0u,
+                 const UploadSpan *staged = nullptr)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, materialArray);
+    endLevel = std::min(endLevel, cached.levelCount);
+    size_t stagedOffset = staged ? staged->offset : 0;
+    if (staged)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadRing.buffer());
+    for (uint32_t level = firstLevel; level < endLevel; level++)
+    {
+        GLsizei size = std::max(1u, MATERIAL_LAYER_SIZE >> level);
+        auto copy = [&](const void *source)
+        {
+            if (materialArrayFormat == TEXTURE_CACHE_RGBA8)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, source);
+            else
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, size, size, 1, materialArrayFormat,
+                                          cached.levelBytes[level], source);
+        };
+        if (staged)
+        {
+            copy((const void *)(uintptr_t)stagedOffset);
+            stagedOffset += cached.levelBytes[level];
+        }
+        else
+            uploadPixels(cached.levels[level], cached.levelBytes[level], copy);
+    }
+    if (staged)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// GL thread: the shared layer for key, uploading image into a free layer on
+// first use (its tail levels from staged, if a worker put them in the upload
+// ring). Falls back to the placeholder layer if the image did not cook or
+// the array is full.
+int acquireLayer(uint64_t key, shared_ptr<DecodedImage> image, const char *path, const UploadSpan *staged)
+{
+    int layer;
+    if (layerCache.acquire(key, layer))
+        return layer;
+    if (!image)
+        image = loadTextureImage(path, key, MATERIAL_LAYER_SIZE); // released since the worker found it cached
+    if (!image->cached.header)
+        return 0;
+    if (freeLayers.empty())
+    {
+        cout << "WARNING: No free material layer for " << path << endl;
+        return 0;
+    }
+    layer = freeLayers.back();
+    freeLayers.pop_back();
+    uint32_t tail = layerTailLevel(image->cached);
+    uploadLayer(image->cached, layer, tail, ~0u, staged);
+    layerStreams[layer] = LayerStream();
+    layerStreams[layer].residentLevel = tail;
+    if (tail > 0)
+        layerStreams[layer].image = image;
+    layerCache.insert(key, layer, textureBytes(*image));
+    layerKeys[layer] = key;
+    return layer;
+}
+
+// Points every material drawing layer at its finest resident level.
+void updateLayerResidency(int layer)
+{
+    for (MaterialData &material : materials)
+        if (material.layer[0] == layer && material.layer[1] != layerStreams[layer].residentLevel)
+        {
+            material.layer[1] = layerStreams[layer].residentLevel;
+            materialsDirty = true;
+        }
+}
+
+// Records how large one repeat of a material's texture appears this frame,
+// in pixels; streamMaterialLayers refines the layer to match.
+void noteTextureCoverage(int material, float screenPixels)
+{
+    LayerStream &stream = layerStreams[materials[material].layer[0]];
+    stream.screenPixels = std::max(stream.screenPixels, screenPixels);
+}
+
+// Uploads the next finer level of streaming layers that are coarser on screen
+// than last frame's coverage asked for, largest coverage first, until
+// byteBudget is spent. At least one level goes per call, so a level larger
+// than the budget still arrives. Clears the coverage for the next frame.
+void streamMaterialLayers(size_t byteBudget)
+{
+    size_t spent = 0;
+    while (spent < byteBudget)
+    {
+        int best = -1;
+        for (int layer = 1; layer < MATERIAL_LAYERS; layer++)
+        {
+            const LayerStream &stream = layerStreams[layer];
+            if (!stream.image || stream.screenPixels <= 0.0f)
+                continue;
+            // finest level the coverage can show, one texel per pixel
+            int wanted = (int)floorf(log2f(MATERIAL_LAYER_SIZE / stream.screenPixels));
+            if (stream.residentLevel > std::max(wanted, 0) && (best < 0 || stream.screenPixels > layerStreams[best].screenPixels))
+                best = layer;
+        }
+        if (best < 0)
+            break;
+        LayerStream &stream = layerStreams[best];
+        uint32_t level = stream.residentLevel - 1;
+        uploadLayer(stream.image->cached, best, level, level + 1);
+        spent += stream.image->cached.levelBytes[level];
+        stream.residentLevel = level;
+        if (level == 0)
+            stream.image.reset(); // fully resident
+        updateLayerResidency(best);
+    }
+    textureStreamBytes += spent;
+    for (LayerStream &stream : layerStreams)
+        stream.screenPixels = 0.0f;
+}
+
+// Drops a reference taken by acquireLayer; the layer is freed with the last
+// one. The placeholder layer is left alone.
+void releaseLayer(int layer)
+{
+    if (layer <= 0 || !layerKeys[layer])
+        return;
+    int last;
+    if (layerCache.release(layerKeys[layer], last))
+    {
+        layerKeys[layer] = 0;
+        layerStreams[layer] = LayerStream();
+        freeLayers.push_back(layer);
+    }
+}
+
+// Adds a material drawing the placeholder layer until requestTexture gives it
+// a texture. Returns its index for uMaterial, or the default material 0 when
+// the UBO is full.
+int createMaterial(const MaterialData &material)
+{
+    if (materials.size() >= (size_t)MAX_MATERIALS)
+    {
+        cout << "WARNING: Out of materials" << endl;
+        return 0;
+    }
+    materials.push_back(material);
+    materials.back().layer[0] = materials.back().layer[1] = 0;
+    materialsDirty = true;
+    return (int)materials.size() - 1;
+}
+
+// Sets the hit flash of a model's material and its batches' materials.
+void setMaterialHitFlash(const DragonModel &model, vec3 color, float strength)
+{
+    vec4 hitFlash(color, strength);
+    auto set = [&](int material)
+    {
+        if (material > 0 && materials[material].hitFlash != hitFlash)
+        {
+            materials[material].hitFlash = hitFlash;
+            materialsDirty = true;
+        }
+    };
+    set(model.material);
+    for (const ModelBatch &batch : model.batches)
+        set(batch.material);
+}
+
+void printUploadRingStats()
+{
+    UploadRingStats stats = uploadRing.stats();
+    cout << "Upload ring: " << stats.bytesStaged / 1024 << " KB staged, " << stats.bytesInFlight / 1024 << " KB in flight (peak "
+         << stats.peakBytesInFlight / 1024 << " KB), " << stats.fenceWaits << " fence waits (" << stats.fenceWaitMs << " ms), "
+         << stats.stalls << " stalls" << endl;
+}
+
+// Writes bytes to the start of a buffer (bound to target), copied in through
+// the upload ring when it has space.
+void uploadBuffer(GLenum target, GLuint buffer, const void *data, size_t bytes)
+{
+    glBindBuffer(target, buffer);
+    UploadSpan span;
+    if (uploadRing.stage(data, bytes, span))
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, uploadRing.buffer());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, target, span.offset, 0, bytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        uploadRing.issued(span);
+    }
+    else
+        glBufferSubData(target, 0, bytes, data);
+}
+
+// Frame setup: binds the material array to unit 0 and the material UBO to its
+// block, uploading the parameters first if any changed.
+void bindMaterials()
+{
+    if (materialsDirty)
+    {
+        uploadBuffer(GL_UNIFORM_BUFFER, materialUBO, materials.data(), materials.size() * sizeof(MaterialData));
+        materialsDirty = false;
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialUBO);
+    glState.bindTexture(0, GL_TEXTURE_2D_ARRAY, materialArray);
+}
+
+void setupFrameBlocks()
+{
+    glGenBuffers(1, &frameUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &lightUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightData), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Uploads frameData and the lights in use, once per frame before the first
+// pass, and binds both blocks.
+void updateFrameBlocks()
+{
+    uploadBuffer(GL_UNIFORM_BUFFER, frameUBO, &frameData, sizeof(frameData));
+    uploadBuffer(GL_UNIFORM_BUFFER, lightUBO, &lightData, sizeof(lightData));
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, frameUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, lightUBO);
+}
+
+// Gives material the texture at path once a worker has cooked it into a
+// layer image and the GL thread has copied it into the array; until then it
+// keeps its current layer. Files with the same bytes share one decode and
+// one layer.
+void requestTexture(int material, const char *path)
+{
+    requestTextures({{material, path}});
+}
+
+// Requests a set of textures together: each is decoded as its own job, so
+// the whole set spreads over the worker pool, and the last job to finish
+// hands the GL thread a single upload pass for all of them.
+void requestTextures(const vector<TextureRequest> &requests)
+{
+    struct DecodedTexture
+    {
+        bool hashed = false;
+        uint64_t key = 0;
+        shared_ptr<DecodedImage> image;
+        bool staged = false; // tail levels written into the upload ring
+        UploadSpan span;
+    };
+    struct TextureBatch
+    {
+        vector<TextureRequest> requests;
+        vector<DecodedTexture> decoded;
+        atomic<size_t> remaining{0};
+    };
+    shared_ptr<TextureBatch> batch = make_shared<TextureBatch>();
+    batch->requests = requests;
+    batch->decoded.resize(requests.size());
+    batch->remaining = requests.size();
+
+    for (size_t i = 0; i < requests.size(); i++)
+        assetLoader.submit([batch, i]()
+                           {
+            const string &file = batch->requests[i].path;
+            DecodedTexture &decoded = batch->decoded[i];
+            decoded.hashed = hashFile(file.c_str(), decoded.key);
+            if (!decoded.hashed)
+                decodeImage(file.c_str()); // fails and reports why
+            else if (!layerCache.contains(decoded.key))
+                decoded.image = decodeImageShared(decoded.key, file.c_str());
+            if (decoded.image && decoded.image->cached.header)
+            {
+                // the GL thread then only issues the copy
+                const TextureCacheView &cached = decoded.image->cached;
+                uint32_t tail = layerTailLevel(cached);
+                decoded.staged = uploadRing.reserve(layerLevelBytes(cached, tail), decoded.span);
+                for (uint32_t level = tail, offset = 0; decoded.staged && level < cached.levelCount; offset += cached.levelBytes[level++])
+                    memcpy((char *)decoded.span.data + offset, cached.levels[level], cached.levelBytes[level]);
+            }
+
+            AssetUpload upload;
+            if (--batch->remaining > 0)
+                return upload; // another job uploads the batch
+            for (const DecodedTexture &texture : batch->decoded)
+                if (texture.image && texture.image->cached.header)
+                    upload.bytes += layerLevelBytes(texture.image->cached, layerTailLevel(texture.image->cached));
+            upload.upload = [batch]()
+            {
+                for (size_t t = 0; t < batch->requests.size(); t++)
+                {
+                    const TextureRequest &request = batch->requests[t];
+                    const DecodedTexture &texture = batch->decoded[t];
+                    if (!texture.hashed)
+                        continue;
+                    MaterialData &material = materials[request.material];
+                    int layer = acquireLayer(texture.key, texture.image, request.path.c_str(), texture.staged ? &texture.span : nullptr);
+                    if (texture.staged)
+                        uploadRing.issued(texture.span);
+                    releaseLayer(material.layer[0]);
+                    material.layer[0] = layer;
+                    material.layer[1] = layerStreams[layer].residentLevel;
+                    materialsDirty = true;
+                }
+                batch->decoded.clear(); // pixel buffers go back to the pool
+            };
+            return upload; });
+}
+
+// The material array (every level allocated up front, layer 0 flat grey) and
+// the material UBO with the default material 0 and the fireball's.
+void setupMaterials()
+{
+    materialArrayFormat = textureCacheFormat(false);
+    uint32_t levelCount = mipLevelCount(MATERIAL_LAYER_SIZE, MATERIAL_LAYER_SIZE);
+    glGenTextures(1, &materialArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, materialArray);
+    for (uint32_t level = 0, size = MATERIAL_LAYER_SIZE; level < levelCount; level++, size = std::max(1u, size / 2))
+    {
+        if (materialArrayFormat == TEXTURE_CACHE_RGBA8)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size, size, MATERIAL_LAYERS, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        else
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, materialArrayFormat, size, size, MATERIAL_LAYERS, 0,
+                                   (GLsizei)(textureCacheLevelBytes(materialArrayFormat, size, size) * MATERIAL_LAYERS), nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Grey placeholder: every block (or pixel) of every level is the same
+    uint8_t grey[16 * 4];
+    for (int i = 0; i < 16; i++)
+        grey[i * 4] = grey[i * 4 + 1] = grey[i * 4 + 2] = 128, grey[i * 4 + 3] = 255;
+    size_t unitBytes = materialArrayFormat == TEXTURE_CACHE_RGBA8 ? 4 : textureBlockBytes(materialArrayFormat);
+    vector<uint8_t> unit(unitBytes);
+    if (materialArrayFormat == TEXTURE_CACHE_RGBA8)
+        memcpy(unit.data(), grey, 4);
+    else
+        compressImage(grey, 4, 4, materialArrayFormat, unit.data(), 1);
+    vector<vector<uint8_t>> levels(levelCount);
+    TextureCacheView placeholder;
+    placeholder.levelCount = levelCount;
+    for (uint32_t level = 0, size = MATERIAL_LAYER_SIZE; level < levelCount; level++, size = std::max(1u, size / 2))
+    {
+        size_t bytes = textureCacheLevelBytes(materialArrayFormat, size, size);
+        for (size_t offset = 0; offset < bytes; offset += unitBytes)
+            levels[level].insert(levels[level].end(), unit.begin(), unit.end());
+        placeholder.levels[level] = (const char *)levels[level].data();
+        placeholder.levelBytes[level] = (uint32_t)bytes;
+    }
+    uploadLayer(placeholder, 0);
+    for (int layer = MATERIAL_LAYERS - 1; layer > 0; layer--)
+        freeLayers.push_back(layer);
+
+    glGenBuffers(1, &materialUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, materialUBO);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(MaterialData), nullptr, GL_DYNAMIC_DRAW);
+    createMaterial(MaterialData());
+    MaterialData fireball;
+    fireball.baseColor = vec4(0.0f);
+    fireball.emissive = vec4(vec3(1.0f, 0.45f, 0.15f) * 2.0f, 0.0f); // bright orange core
+    fireballMaterial = createMaterial(fireball);
+    domeMaterial = createMaterial(MaterialData());
+}
+
+// Stand-in mesh drawn until models arrive: a small cube with the default
+// material (the grey placeholder layer).
+void setupPlaceholders()
+{
+    IndexedMesh cube;
+    for (int face = 0; face < 6; face++)
+    {
+        int axis = face / 2;
+        float sign = face % 2 ? -1.0f : 1.0f;
+        vec3 n(0.0f), u(0.0f), v(0.0f);
+        n[axis] = sign;
+        u[(axis + 1) % 3] = 1.0f;
+        v[(axis + 2) % 3] = sign;
+        uint32_t base = (uint32_t)cube.vertices.size();
+        for (int corner = 0; corner < 4; corner++)
+        {
+            vec2 uv((float)(corner & 1), (float)(corner >> 1));
+            vec3 p = (n + u * (uv.x * 2.0f - 1.0f) + v * (uv.y * 2.0f - 1.0f)) * 2.0f;
+            cube.vertices.push_back({p, n, uv});
+        }
+        uint32_t quad[6] = {0, 1, 3, 0, 3, 2};
+        for (uint32_t index : quad)
+            cube.indices.push_back(base + index);
+    }
+    vector<char> image;
+    buildMeshCache(cube, 0, 0, image);
+    uploadMeshCache(placeholderModel, (const MeshCacheHeader *)image.data());
+}
+
 void setupShadowMapping()
 {
     glGenFramebuffers(1, &depthMapFBO);
@@ -468,220 +1442,633 @@ void setupCube()
     glBindVertexArray(0);
 }
 
-void setupSphere()
+// Fireball impostor quad (a triangle strip over [-1,1]) and the instance
+// buffer its per-fireball attributes come from.
+void setupFireballs()
+{
+    const float corners[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+    glGenVertexArrays(1, &fireballVAO);
+    glGenBuffers(1, &fireballQuadVBO);
+    glGenBuffers(1, &fireballInstanceVBO);
+    glBindVertexArray(fireballVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, fireballQuadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, fireballInstanceVBO);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(FireballInstance), (void *)offsetof(FireballInstance, position)); // + radius
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(FireballInstance), (void *)offsetof(FireballInstance, phase));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+    glBindVertexArray(0);
+}
+
+// Queues every live projectile inside the view as one instanced draw of the
+// impostor quad.
+void renderFireballs()
+{
+    static vector<FireballInstance> instances;
+    static CullSet spheres;
+    static vector<uint8_t> visible;
+    spheres.clear();
+    for (const Projectile &projectile : projectileList)
+    {
+        FireballInstance instance = projectile.instance();
+        spheres.add(instance.position, vec3(instance.radius));
+    }
+    size_t count = spheres.cull(sceneFrustum, visible);
+    sceneCullStats.visible += count;
+    sceneCullStats.culled += spheres.size() - count;
+
+    instances.clear();
+    size_t i = 0;
+    for (const Projectile &projectile : projectileList)
+        if (visible[i++])
+            instances.push_back(projectile.instance());
+    fireballsDrawn = instances.size();
+    if (instances.empty())
+        return;
+
+    if (instances.size() > fireballCapacity)
+    {
+        fireballCapacity = glm::max(instances.size(), fireballCapacity * 2);
+        glBindBuffer(GL_ARRAY_BUFFER, fireballInstanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, fireballCapacity * sizeof(FireballInstance), nullptr, GL_DYNAMIC_DRAW);
+    }
+    uploadBuffer(GL_ARRAY_BUFFER, fireballInstanceVBO, instances.data(), instances.size() * sizeof(FireballInstance));
+
+    DrawCommand draw;
+    draw.kind = DRAW_FIREBALLS;
+    draw.material = fireballMaterial;
+    draw.vao = fireballVAO;
+    draw.mode = GL_TRIANGLE_STRIP;
+    draw.count = 4;
+    draw.instances = (GLsizei)instances.size();
+    renderQueue.submit(renderSortKey(RENDER_PASS_OPAQUE, fireballShaderProgram, fireballMaterial, fireballVAO, 0.0f), draw);
+}
+
+void renderGround(mat4 model, mat4 view, mat4 projection)
+{
+    // one texture repeat spans 2 units (100-unit quad, UVs 0..50), nearest
+    // straight below the eye
+    float eyeHeight = glm::max(fabsf(vec3(inverse(view)[3]).y - model[3].y), 0.1f);
+    noteTextureCoverage(domeMaterial, HEIGHT * 0.5f * projection[1][1] * 2.0f / eyeHeight);
+    if (!cullTest(sceneFrustum, sceneCullStats, groundBounds, model))
+        return;
+
+    DrawCommand draw;
+    draw.model = model;
+    draw.vao = groundVAO;
+    draw.count = 6;
+    submitSceneDraw(draw, materialFeatures(domeMaterial), domeMaterial, RENDER_PASS_OPAQUE, eyeHeight);
+}
+
+// Assimp post-process flags for importDragonMesh. Welding, cache ordering and
+// merging per material are done by our own pipeline either way; the heavier
+// profiles only help with sources that need Assimp's cleanup.
+unsigned importProfileFlags(ImportProfile profile)
+{
+    switch (profile)
+    {
+    case IMPORT_BALANCED:
+        return aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType;
+    case IMPORT_QUALITY:
+        return aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_SortByPType |
+               aiProcess_ImproveCacheLocality | aiProcess_OptimizeMeshes;
+    default:
+        return aiProcess_Triangulate;
+    }
+}
+
+// Appends the triangles of every mesh under node to the corner list of its
+// material, with the node's accumulated transform baked into positions and
+// normals.
+void collectNodeMeshes(const aiScene *scene, const aiNode *node, const mat4 &parentTransform,
+                       vector<vector<MeshVertex>> &materialCorners, unsigned &meshCount, unsigned &nodeCount)
+{
+    aiMatrix4x4 local = node->mTransformation; // row-major
+    mat4 transform = parentTransform * transpose(make_mat4(&local.a1));
+    mat3 normalMatrix = transpose(inverse(mat3(transform)));
+    nodeCount++;
+
+    for (unsigned int m = 0; m < node->mNumMeshes; m++)
+    {
+        const aiMesh *aimesh = scene->mMeshes[node->mMeshes[m]];
+        vector<MeshVertex> &corners = materialCorners[aimesh->mMaterialIndex];
+        for (unsigned int i = 0; i < aimesh->mNumFaces; i++)
+        {
+            const aiFace &face = aimesh->mFaces[i];
+            if (face.mNumIndices != 3)
+                continue; // points/lines left over by aiProcess_Triangulate
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                unsigned int k = face.mIndices[j];
+                MeshVertex v;
+                v.position = vec3(transform * vec4(aimesh->mVertices[k].x, aimesh->mVertices[k].y, aimesh->mVertices[k].z, 1.0f));
+                if (aimesh->HasNormals())
+                    v.normal = normalize(normalMatrix * vec3(aimesh->mNormals[k].x, aimesh->mNormals[k].y, aimesh->mNormals[k].z));
+                else
+                    v.normal = vec3(0.0f, 1.0f, 0.0f);
+                if (aimesh->mTextureCoords[0])
+                    v.uv = vec2(aimesh->mTextureCoords[0][k].x, aimesh->mTextureCoords[0][k].y);
+                else
+                    v.uv = vec2(0.0f, 0.0f);
+                corners.push_back(v);
+            }
+        }
+        meshCount++;
+    }
+    for (unsigned int c = 0; c < node->mNumChildren; c++)
+        collectNodeMeshes(scene, node->mChildren[c], transform, materialCorners, meshCount, nodeCount);
+}
+
+// Reads a model through Assimp into a welded, indexed mesh (CPU only). Every
+// mesh in the node hierarchy is read; meshes sharing a material are merged
+// into one batch so the model draws with one call per material.
+bool importDragonMesh(const char *objPath, IndexedMesh &mesh, ImportProfile profile)
+{
+    cout << "Loading model with Assimp: " << objPath << endl;
+
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(objPath, importProfileFlags(profile));
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+    {
+        cout << "ERROR: Assimp failed to load " << objPath << ": " << importer.GetErrorString() << endl;
+        return false;
+    }
+
+    vector<vector<MeshVertex>> materialCorners(scene->mNumMaterials);
+    unsigned meshCount = 0, nodeCount = 0;
+    collectNodeMeshes(scene, scene->mRootNode, mat4(1.0f), materialCorners, meshCount, nodeCount);
+
+    // Assimp's OBJ import keeps one vertex per face corner; weld identical
+    // (position, normal, uv) vertices so shared corners are stored once.
+    vector<MeshVertex> corners;
+    for (const vector<MeshVertex> &batchCorners : materialCorners)
+        corners.insert(corners.end(), batchCorners.begin(), batchCorners.end());
+    weldVertices(corners.data(), corners.size(), mesh.vertices, mesh.indices);
+
+    string directory = objPath;
+    directory = directory.substr(0, directory.find_last_of("/\\") + 1);
+    mesh.batches.clear();
+    uint32_t firstIndex = 0;
+    for (unsigned int m = 0; m < materialCorners.size(); m++)
+    {
+        uint32_t count = (uint32_t)materialCorners[m].size();
+        if (count == 0)
+            continue;
+        MeshBatch batch;
+        batch.material = m;
+        batch.lods.push_back({firstIndex, count});
+        aiString texture;
+        if (scene->mMaterials[m]->GetTexture(aiTextureType_DIFFUSE, 0, &texture) == AI_SUCCESS && texture.C_Str()[0] != '*')
+        {
+            string path = directory + texture.C_Str();
+            if (FILE *file = fopen(path.c_str(), "rb"))
+            {
+                fclose(file);
+                batch.diffuseTexture = path;
+            }
+        }
+        mesh.batches.push_back(batch);
+        firstIndex += count;
+    }
+
+    cout << "Loaded " << meshCount << " meshes from " << nodeCount << " nodes into " << mesh.batches.size() << " material batches: "
+         << mesh.vertices.size() << " unique vertices, " << mesh.indices.size() << " indices" << endl;
+
+    // Reorder for the post-transform cache, overdraw and vertex fetch.
+    VertexCacheStats before = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeMesh(mesh, /*reduceOverdraw=*/true);
+    VertexCacheStats after = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+    cout << "Vertex cache ACMR " << before.acmr << " -> " << after.acmr
+         << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+
+    // Simplified levels share the vertex buffer and follow LOD 0 in the index buffer.
+    buildLodChain(mesh, MESH_CACHE_MAX_LODS);
+    cout << "LOD triangles:";
+    for (const MeshLod &lod : mesh.lods)
+        cout << " " << lod.indexCount / 3 << " (err " << lod.error << ")";
+    cout << endl;
+    return true;
+}
+
+// Mesh cache contents ready for upload: either a mapped cache file or an image
+// built in memory from a fresh import. header is null if loading failed.
+struct LoadedMesh
+{
+    MeshCacheFile cache;
+    vector<char> image;
+    const MeshCacheHeader *header = nullptr;
+    uint64_t key = 0; // content key for modelMeshCache: source hash + cache flags
+};
+
+// Loads a model through its binary mesh cache (<obj>.meshcache). A valid cache
+// is mapped as-is; otherwise the OBJ is imported with Assimp and the cache is
+// (re)written for the next run. CPU only, safe on a worker thread.
+bool loadMeshCache(const char *objPath, LoadedMesh &out)
+{
+    double startTime = glfwGetTime();
+    uint64_t sourceHash;
+    if (!hashFile(objPath, sourceHash))
+    {
+        cout << "ERROR: Unable to open model " << objPath << endl;
+        return false;
+    }
+
+    string cachePath = meshCachePath(objPath);
+    const uint32_t cacheFlags = (useQuantizedVertices ? (uint32_t)MESH_CACHE_QUANTIZED : 0u) | ((uint32_t)importProfile << MESH_CACHE_IMPORTER_SHIFT);
+    out.key = hashBytes64(&cacheFlags, sizeof(cacheFlags), sourceHash);
+    if (out.cache.open(cachePath.c_str(), sourceHash, cacheFlags))
+    {
+        out.header = out.cache.header;
+        cout << "Mesh cache hit: " << cachePath << " (" << (glfwGetTime() - startTime) * 1000.0 << " ms)" << endl;
+        return true;
+    }
+
+    IndexedMesh mesh;
+    if (!importDragonMesh(objPath, mesh))
+        return false;
+    buildMeshCache(mesh, sourceHash, cacheFlags, out.image);
+    if (!writeCacheFile(cachePath.c_str(), out.image))
+        cout << "WARNING: Unable to write mesh cache " << cachePath << endl;
+    out.header = validateMeshCache(out.image.data(), out.image.size(), sourceHash, cacheFlags);
+    cout << "Mesh cache miss: " << objPath << " imported in " << (glfwGetTime() - startTime) * 1000.0 << " ms" << endl;
+    return out.header != nullptr;
+}
+
+// Queues a model for background loading. Until its mesh and texture arrive the
+// model draws as the placeholder; a mesh that fails to load leaves it empty.
+// Models whose files have the same bytes share one set of GL buffers.
+void requestDragonModel(DragonModel &model, const char *objPath)
+{
+    model = placeholderModel;
+    DragonModel *modelPtr = &model;
+    string file = objPath;
+    assetLoader.submit([modelPtr, file]()
+                       {
+        shared_ptr<LoadedMesh> mesh = make_shared<LoadedMesh>();
+        if (!loadMeshCache(file.c_str(), *mesh))
+            cout << "ERROR: Failed to load model " << file << endl;
+        AssetUpload upload;
+        upload.bytes = mesh->header ? meshCacheVertexBytes(mesh->header) + meshCacheIndexBytes(mesh->header) : 0;
+        upload.upload = [modelPtr, mesh, file]()
+        {
+            // stop sharing the placeholder's buffers; keep the model's material
+            int material = modelPtr->material;
+            *modelPtr = DragonModel();
+            modelPtr->material = material;
+            if (mesh->header)
+            {
+                if (modelMeshCache.acquire(mesh->key, *modelPtr))
+                    cout << "Model " << file << " shares the buffers of an identical model" << endl;
+                else
+                {
+                    uploadMeshCache(*modelPtr, mesh->header);
+                    modelPtr->meshKey = mesh->key;
+                    modelMeshCache.insert(mesh->key, *modelPtr, meshCacheVertexBytes(mesh->header) + meshCacheIndexBytes(mesh->header));
+                }
+                modelPtr->material = material;
+                requestBatchTextures(*modelPtr, mesh->header);
+                cout << "Model " << file << ": " << modelPtr->batches.size() << " material batches" << endl;
+            }
+        };
+        return upload; });
+}
+
+// Uploads a cache image (mapped file or in-memory) straight into the model's
+// VBO/EBO, using the vertex layout recorded in the cache header.
+void uploadMeshCache(DragonModel &model, const MeshCacheHeader *cache)
+{
+    if (model.VAO == 0)
+    {
+        glGenVertexArrays(1, &model.VAO);
+        glGenBuffers(1, &model.VBO);
+        glGenBuffers(1, &model.EBO);
+    }
+    glBindVertexArray(model.VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, model.VBO);
+    glBufferData(GL_ARRAY_BUFFER, meshCacheVertexBytes(cache), meshCacheVertices(cache), GL_STATIC_DRAW);
+    for (uint32_t i = 0; i < cache->attributeCount; i++)
+    {
+        const MeshCacheAttribute &a = cache->attributes[i];
+        glVertexAttribPointer(a.location, a.components, a.type, a.normalized ? GL_TRUE : GL_FALSE, cache->vertexStride, (void *)(uintptr_t)a.offset);
+        glEnableVertexAttribArray(a.location);
+    }
+    // instance attributes, pointed at the run to draw by instanced draws
+    for (GLuint i = 0; i < 7; i++)
+    {
+        glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + i);
+        glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + i, 1);
+    }
+    bindInstanceAttributes(0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshCacheIndexBytes(cache), meshCacheIndices(cache), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    model.indexType = cache->indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    model.vertexCount = (GLsizei)cache->vertexCount;
+    model.indexCount = (GLsizei)cache->indexCount;
+    model.bounds = boundsFromBox(make_vec3(cache->aabbMin), make_vec3(cache->aabbMax));
+    bool quantized = (cache->flags & MESH_CACHE_QUANTIZED) != 0;
+    model.dequantize = quantized ? dequantizationMatrix(model.bounds.min, model.bounds.max) : mat4(1.0f);
+    model.octNormals = quantized;
+    model.lods.assign(cache->lods, cache->lods + cache->lodCount);
+
+    model.batches.assign(cache->batchCount, ModelBatch());
+    for (uint32_t b = 0; b < cache->batchCount; b++)
+    {
+        const MeshCacheBatch &batch = meshCacheBatches(cache)[b];
+        copy(batch.lods, batch.lods + MESH_CACHE_MAX_LODS, model.batches[b].lods);
+    }
+}
+
+// Requests the material textures named in the cache for the model's batches.
+void requestBatchTextures(DragonModel &model, const MeshCacheHeader *cache)
 {
-    const int stacks = 20, slices = 20;
-    const float radius = 1.0f;
-    vector<float> vertices;
-    for (int i = 0; i <= stacks; ++i)
+    vector<TextureRequest> requests;
+    for (uint32_t b = 0; b < cache->batchCount && b < model.batches.size(); b++)
     {
-        float stackAngle = M_PI / 2 - i * M_PI / stacks;
-        float xy = radius * cosf(stackAngle);
-        float z = radius * sinf(stackAngle);
-        for (int j = 0; j <= slices; ++j)
+        const MeshCacheBatch &batch = meshCacheBatches(cache)[b];
+        if (batch.diffuseTexture[0])
         {
-            float sectorAngle = j * 2 * M_PI / slices;
-            float x = xy * cosf(sectorAngle);
-            float y = xy * sinf(sectorAngle);
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-            vertices.push_back((float)j / slices);
-            vertices.push_back((float)i / stacks);
+            model.batches[b].material = createMaterial(materials[model.material]);
+            requests.push_back({model.batches[b].material, batch.diffuseTexture});
         }
     }
-    vector<unsigned int> indices;
-    for (int i = 0; i < stacks; ++i)
+    if (!requests.empty())
+        requestTextures(requests);
+}
+
+// Drops the model's references to its (possibly shared) buffers and material
+// layers.
+void releaseDragonModel(DragonModel &model)
+{
+    DragonModel last;
+    if (model.meshKey && modelMeshCache.release(model.meshKey, last))
+    {
+        glDeleteVertexArrays(1, &last.VAO);
+        glDeleteBuffers(1, &last.VBO);
+        glDeleteBuffers(1, &last.EBO);
+    }
+    auto releaseMaterialLayer = [](int material)
     {
-        int k1 = i * (slices + 1);
-        int k2 = k1 + slices + 1;
-        for (int j = 0; j < slices; ++j, ++k1, ++k2)
+        if (material > 0)
         {
-            if (i != 0)
-            {
-                indices.push_back(k1);
-                indices.push_back(k2);
-                indices.push_back(k1 + 1);
-            }
-            if (i != (stacks - 1))
-            {
-                indices.push_back(k1 + 1);
-                indices.push_back(k2);
-                indices.push_back(k2 + 1);
-            }
+            releaseLayer(materials[material].layer[0]);
+            materials[material].layer[0] = 0;
+            materialsDirty = true;
         }
-    }
-    sphereVertexCount = (int)indices.size();
-
-    GLuint sphereEBO;
-    glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glGenBuffers(1, &sphereEBO);
-    glBindVertexArray(sphereVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
+    };
+    releaseMaterialLayer(model.material);
+    for (const ModelBatch &batch : model.batches)
+        releaseMaterialLayer(batch.material);
+    model = DragonModel();
 }
 
-void renderGround(GLuint shaderProgram, mat4 model, mat4 view, mat4 projection)
+// Tests one drawable against a frustum and counts the result.
+bool cullTest(const Frustum &frustum, CullStats &stats, const Bounds &bounds, const mat4 &model)
 {
-    glUseProgram(shaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, value_ptr(projection));
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, domeTexture);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture_diffuse1"), 0);
-
-    // ensure not emissive
-    glUniform1f(glGetUniformLocation(shaderProgram, "isFireball"), 0.0f);
+    vec3 center, extent;
+    worldBox(bounds, model, center, extent);
+    bool visible = frustumContainsBox(frustum, center, extent);
+    (visible ? stats.visible : stats.culled)++;
+    return visible;
+}
 
-    glBindVertexArray(groundVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+// The draw of one level of the model: the given material batch, or with
+// batch < 0 every batch in a single call (depth-only passes need no material
+// changes). With instances > 0 it draws that many instances, whose
+// InstanceData starts at record firstInstance of instanceVBO. Counts the
+// triangles for the LOD readout.
+DrawCommand dragonModelDraw(const DragonModel &model, int lod, int batch, GLsizei instances, GLint firstInstance)
+{
+    DrawCommand draw;
+    if (model.lods.empty())
+        return draw;
+    lod = glm::clamp(lod, 0, (int)model.lods.size() - 1);
+    MeshRange range = {model.lods[lod].firstIndex, model.lods[lod].indexCount};
+    uint32_t fullCount = model.lods[0].indexCount;
+    if (batch >= 0)
+    {
+        range = model.batches[batch].lods[lod];
+        fullCount = model.batches[batch].lods[0].indexCount;
+    }
+    size_t indexSize = model.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    size_t copies = instances > 0 ? instances : 1;
+    lodTrianglesDrawn += range.indexCount / 3 * copies;
+    lodTrianglesFull += fullCount / 3 * copies;
+
+    draw.dequantize = model.dequantize;
+    draw.octNormals = model.octNormals;
+    draw.vao = model.VAO;
+    draw.count = (GLsizei)range.indexCount;
+    draw.indexType = model.indexType;
+    draw.first = range.firstIndex * indexSize;
+    draw.instances = instances;
+    draw.firstInstance = firstInstance;
+    return draw;
 }
 
-bool loadDragonModel(DragonModel &model, const char *objPath, const char *texturePath)
+// Queues a draw with the scene variant for features, keyed so that opaque
+// draws sharing program, material and VAO go front to back.
+void submitSceneDraw(DrawCommand command, uint32_t features, int material, uint32_t pass, float depth)
 {
-    cout << "Loading model with Assimp: " << objPath << endl;
+    if (command.count == 0)
+        return;
+    command.kind = DRAW_SCENE;
+    command.features = features & SHADER_ALL_FEATURES;
+    command.material = material;
+    renderQueue.submit(renderSortKey(pass, sceneVariants[command.features].program, (uint32_t)material, command.vao, depth), command);
+}
 
-    Assimp::Importer importer;
-    // Only use essential flags for speed
-    const aiScene *scene = importer.ReadFile(objPath, aiProcess_Triangulate);
+// Queues a depth-only draw into the shadow map; depth is the distance from
+// the light.
+void submitShadowDraw(DrawCommand command, GLuint program, float depth)
+{
+    if (command.count == 0)
+        return;
+    command.kind = DRAW_SHADOW;
+    command.program = program;
+    renderQueue.submit(renderSortKey(RENDER_PASS_SHADOW, program, 0, command.vao, depth), command);
+}
 
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+// Applies a queued draw's state through glState and issues it.
+void executeDraw(const DrawCommand &command)
+{
+    glState.setPolygonMode(GL_FILL);
+    glState.setCullFace(command.cullFace);
+    glState.setDepthMask(command.depthWrite);
+    switch (command.kind)
     {
-        cout << "ERROR: Assimp failed to load " << objPath << ": " << importer.GetErrorString() << endl;
-        return false;
+    case DRAW_SCENE:
+    {
+        SceneVariant &variant = sceneVariants[command.features];
+        glState.useProgram(variant.program);
+        if (command.instances > 0)
+            variant.uniforms.octNormals.set(command.octNormals);
+        else
+            setModelUniforms(variant.uniforms, command.model, command.dequantize, command.octNormals);
+        variant.uniforms.material.set(command.material);
+        break;
+    }
+    case DRAW_SHADOW:
+        glState.useProgram(command.program);
+        if (command.instances == 0)
+            shadowUniforms.model.set(command.model * command.dequantize);
+        break;
+    case DRAW_FIREBALLS:
+        glState.useProgram(fireballShaderProgram);
+        fireballUniforms.material.set(command.material);
+        break;
     }
 
-    model.vertices.clear();
-    model.normals.clear();
-    model.uvs.clear();
+    glState.bindVertexArray(command.vao);
+    if (command.instances > 0 && command.kind != DRAW_FIREBALLS)
+        bindInstanceAttributes(command.firstInstance);
+    if (command.indexType && command.instances > 0)
+        glDrawElementsInstanced(command.mode, command.count, command.indexType, (const void *)command.first, command.instances);
+    else if (command.indexType)
+        glDrawElements(command.mode, command.count, command.indexType, (const void *)command.first);
+    else if (command.instances > 0)
+        glDrawArraysInstanced(command.mode, (GLint)command.first, command.count, command.instances);
+    else
+        glDrawArrays(command.mode, (GLint)command.first, command.count);
+    modelDrawCalls++;
+    instancesDrawn += command.instances;
+}
 
-    // Process only the first mesh for speed
-    if (scene->mNumMeshes > 0)
+// Sets up the target of pass; flushRenderQueue() begins every pass in order,
+// with or without draws.
+void beginRenderPass(uint32_t pass)
+{
+    switch (pass)
     {
-        aiMesh *mesh = scene->mMeshes[0];
-
-        // Reserve space for better performance
-        model.vertices.reserve(mesh->mNumFaces * 3);
-        model.normals.reserve(mesh->mNumFaces * 3);
-        model.uvs.reserve(mesh->mNumFaces * 3);
-
-        // Process faces directly - convert to individual vertices for glDrawArrays
-        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
-        {
-            aiFace face = mesh->mFaces[i];
-            for (unsigned int j = 0; j < face.mNumIndices; j++)
-            {
-                unsigned int index = face.mIndices[j];
-
-                // Vertices
-                model.vertices.push_back(vec3(
-                    mesh->mVertices[index].x,
-                    mesh->mVertices[index].y,
-                    mesh->mVertices[index].z));
-
-                // Normals
-                if (mesh->HasNormals())
-                {
-                    model.normals.push_back(vec3(
-                        mesh->mNormals[index].x,
-                        mesh->mNormals[index].y,
-                        mesh->mNormals[index].z));
-                }
-                else
-                {
-                    model.normals.push_back(vec3(0.0f, 1.0f, 0.0f));
-                }
-
-                // UVs
-                if (mesh->mTextureCoords[0])
-                {
-                    model.uvs.push_back(vec2(
-                        mesh->mTextureCoords[0][index].x,
-                        mesh->mTextureCoords[0][index].y));
-                }
-                else
-                {
-                    model.uvs.push_back(vec2(0.0f, 0.0f));
-                }
-            }
-        }
+    case RENDER_PASS_SHADOW:
+        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+        glState.setDepthMask(true); // the clear obeys the write mask
+        glClear(GL_DEPTH_BUFFER_BIT);
+        break;
+    case RENDER_PASS_OPAQUE:
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, WIDTH, HEIGHT);
+        glState.setDepthMask(true);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // materials and textures bind once; draws only pick uMaterial
+        bindMaterials();
+        glState.bindTexture(1, GL_TEXTURE_2D, depthMap);
+        break;
+    default:
+        break;
     }
+}
 
-    cout << "Loaded " << model.vertices.size() << " vertices" << endl;
-
-    // Create OpenGL buffers
-    glGenVertexArrays(1, &model.VAO);
-    GLuint vertexVBO, normalVBO, uvVBO;
-    glGenBuffers(1, &vertexVBO);
-    glGenBuffers(1, &normalVBO);
-    glGenBuffers(1, &uvVBO);
+// Sorts and executes the frame's packets. The state counts cover this flush.
+void flushRenderQueue()
+{
+    glState.invalidate(); // loaders and uploads have bound things since the last frame
+    glState.resetStats();
+    renderPackets = renderQueue.size();
+    uint32_t pass = RENDER_PASS_SHADOW;
+    beginRenderPass(pass);
+    renderQueue.flush([&](uint64_t key, const DrawCommand &command)
+                      {
+        while (pass < renderKeyPass(key))
+            beginRenderPass(++pass);
+        executeDraw(command); });
+    while (pass + 1 < RENDER_PASS_COUNT)
+        beginRenderPass(++pass);
+    glState.bindVertexArray(0);
+}
 
-    glBindVertexArray(model.VAO);
+// Makes instanceVBO hold at least count records, creating it on first use.
+void reserveInstances(size_t count)
+{
+    if (instanceVBO && count <= instanceCapacity)
+        return;
+    if (!instanceVBO)
+        glGenBuffers(1, &instanceVBO);
+    instanceCapacity = glm::max(glm::max(count, instanceCapacity * 2), (size_t)(2 * SNAKE_NECK_SEGMENTS));
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+}
 
-    // Vertices
-    glBindBuffer(GL_ARRAY_BUFFER, vertexVBO);
-    glBufferData(GL_ARRAY_BUFFER, model.vertices.size() * sizeof(vec3), model.vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-    glEnableVertexAttribArray(0);
+// Points the bound VAO's instance attributes at record first of instanceVBO
+// (GL 3.3 has no base instance for draws).
+void bindInstanceAttributes(GLint first)
+{
+    reserveInstances(1);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    uintptr_t base = (uintptr_t)first * sizeof(InstanceData);
+    for (GLuint c = 0; c < 4; c++)
+        glVertexAttribPointer(INSTANCE_MODEL_LOCATION + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void *)(base + offsetof(InstanceData, model) + c * sizeof(vec4)));
+    for (GLuint c = 0; c < 3; c++)
+        glVertexAttribPointer(INSTANCE_NORMAL_LOCATION + c, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                              (void *)(base + offsetof(InstanceData, normalMatrix) + c * sizeof(vec3)));
+}
 
-    // Normals
-    glBindBuffer(GL_ARRAY_BUFFER, normalVBO);
-    glBufferData(GL_ARRAY_BUFFER, model.normals.size() * sizeof(vec3), model.normals.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-    glEnableVertexAttribArray(1);
+// Pixels one object-space unit of the model covers in a view, at the nearest
+// point of its bounding sphere.
+float modelPixelsPerUnit(const DragonModel &model, const mat4 &modelMatrix, const LodView &lodView)
+{
+    float maxScale = glm::max(length(vec3(modelMatrix[0])), glm::max(length(vec3(modelMatrix[1])), length(vec3(modelMatrix[2]))));
+    float pixelsPerUnit = lodView.pixelsPerUnit * maxScale;
+    if (!lodView.orthographic)
+    {
+        vec3 center = vec3(modelMatrix * vec4(model.bounds.center, 1.0f));
+        float radius = model.bounds.radius * maxScale;
+        pixelsPerUnit /= glm::max(length(center - lodView.eye) - radius, 0.1f);
+    }
+    return pixelsPerUnit;
+}
 
-    // UVs
-    glBindBuffer(GL_ARRAY_BUFFER, uvVBO);
-    glBufferData(GL_ARRAY_BUFFER, model.uvs.size() * sizeof(vec2), model.uvs.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
-    glEnableVertexAttribArray(2);
+// Picks the coarsest level whose error projects to at most LOD_PIXEL_ERROR
+// pixels. Refining happens immediately; coarsening past currentLod needs the
+// error to be LOD_HYSTERESIS below the budget, so a segment sitting right at
+// a threshold does not toggle every frame.
+int selectLod(const DragonModel &model, const mat4 &modelMatrix, const LodView &lodView, int currentLod)
+{
+    int levels = (int)model.lods.size();
+    if (levels <= 1)
+        return 0;
 
-    glBindVertexArray(0);
-    model.VBO = vertexVBO;
+    float pixelsPerUnit = modelPixelsPerUnit(model, modelMatrix, lodView);
 
-    // Load texture
-    if (texturePath)
-        model.texture = loadTexture(texturePath);
-    else
+    currentLod = glm::clamp(currentLod, 0, levels - 1);
+    int lod = 0;
+    for (int i = levels - 1; i > 0; i--)
     {
-        glGenTextures(1, &model.texture);
-        glBindTexture(GL_TEXTURE_2D, model.texture);
-        unsigned char whitePixel[] = {255, 255, 255};
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, whitePixel);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        float budget = i > currentLod ? LOD_PIXEL_ERROR * LOD_HYSTERESIS : LOD_PIXEL_ERROR;
+        if (model.lods[i].error * pixelsPerUnit <= budget)
+        {
+            lod = i;
+            break;
+        }
     }
-    cout << "Texture ID: " << model.texture << endl;
-    return true;
+    return lod;
 }
 
 void setupSnakeModels()
 {
     cout << "Setting up snake creature models..." << endl;
-    if (!loadDragonModel(dragonHead, "Models/dragon_head.obj", "Textures/dragon_texture.jpg"))
-        cout << "ERROR: Failed to load dragon head!\n";
-    if (!loadDragonModel(fishBody, "Models/fish.obj", "Textures/fish_texture.jpg"))
-        cout << "ERROR: Failed to load fish!\n";
-    if (!loadDragonModel(staff, "Models/staff.obj", "Textures/light_surface.jpg"))
-        cout << "ERROR: Failed to load staff!\n";
+    requestDragonModel(dragonHead, "Models/dragon_head.obj");
+    requestDragonModel(fishBody, "Models/fish.obj");
+    requestDragonModel(staff, "Models/staff.obj");
+    dragonHead.material = createMaterial(MaterialData());
+    fishBody.material = createMaterial(MaterialData());
+    MaterialData glow;
+    glow.emissive = vec4(vec3(1.0f, 0.45f, 0.15f) * 2.0f, 0.0f); // bioluminescent staff
+    staff.material = createMaterial(glow);
+    requestTextures({{dragonHead.material, "Textures/dragon_texture.jpg"},
+                     {fishBody.material, "Textures/fish_texture.jpg"},
+                     {staff.material, "Textures/light_surface.jpg"}});
     for (int i = 0; i < SNAKE_NECK_SEGMENTS; i++)
     {
         snakeNeckSegments[i].animationPhase = (float)i / SNAKE_NECK_SEGMENTS * 2.0f * 3.14159f;
@@ -690,6 +2077,42 @@ void setupSnakeModels()
     }
 }
 
+// ------------------------------------
+// Procedural mesh sharing
+// ------------------------------------
+uint64_t proceduralMeshKey(const char *generator, const float *params, size_t count)
+{
+    return hashBytes64(params, count * sizeof(float), hashBytes64(generator, strlen(generator)));
+}
+
+// Drops a reference to a shared procedural mesh, deleting it with the last one.
+void releaseProceduralMesh(uint64_t key)
+{
+    ProceduralMesh last;
+    if (key && proceduralMeshCache.release(key, last))
+    {
+        glDeleteVertexArrays(1, &last.VAO);
+        glDeleteBuffers(1, &last.VBO);
+        glDeleteBuffers(1, &last.EBO);
+    }
+}
+
+// Switches the dome globals to the procedural mesh for key. Returns true if
+// it already exists; otherwise the globals are cleared and the caller builds
+// it into new buffers and inserts it.
+bool useDomeMesh(uint64_t key)
+{
+    ProceduralMesh mesh;
+    bool shared = proceduralMeshCache.acquire(key, mesh);
+    releaseProceduralMesh(domeMeshKey);
+    domeMeshKey = shared ? key : 0;
+    domeVAO = mesh.VAO;
+    domeVBO = mesh.VBO;
+    domeEBO = mesh.EBO;
+    domeIndexCount = mesh.indexCount;
+    return shared;
+}
+
 // ------------------------------------
 // Polygonal Dome (hemisphere) generator
 // ------------------------------------
@@ -741,6 +2164,15 @@ static void subdivide(const Tri &t, int f, std::vector<Tri> &out)
 // build hemisphere from subdivided icosahedron; duplicate verts per face for flat shading
 void setupDomeGeodesic(int subdivLevel = 2, float radius = 10.0f, float tile = 4.0f)
 {
+    const float params[] = {(float)subdivLevel, radius, tile};
+    uint64_t meshKey = proceduralMeshKey("domeGeodesic", params, 3);
+    domeBounds = boundsFromBox(vec3(-radius, 0.0f, -radius), vec3(radius));
+    if (useDomeMesh(meshKey))
+    {
+        requestTexture(domeMaterial, "Textures/cave.jpg");
+        return;
+    }
+
     std::vector<glm::vec3> V = icosaVerts();
     auto F = icosaFaces();
 
@@ -825,43 +2257,43 @@ void setupDomeGeodesic(int subdivLevel = 2, float radius = 10.0f, float tile = 4
     glEnableVertexAttribArray(2);
     glBindVertexArray(0);
 
-    domeTexture = loadTexture("Textures/cave.jpg");
+    proceduralMeshCache.insert(meshKey, {domeVAO, domeVBO, domeEBO, domeIndexCount},
+                               interleaved.size() * sizeof(float) + indices.size() * sizeof(unsigned int));
+    domeMeshKey = meshKey;
+    requestTexture(domeMaterial, "Textures/cave.jpg");
 }
-void renderDomeGeodesic(GLuint shaderProgram, const glm::mat4 &view, const glm::mat4 &projection)
+void renderDomeGeodesic()
 {
     if (domeVAO == 0 || domeIndexCount == 0)
         return;
 
-    glUseProgram(shaderProgram);
-
-    // don’t block scene: write no depth, draw inside faces
-    glDepthMask(GL_FALSE);
-    glCullFace(GL_FRONT);
-
     glm::mat4 model(1.0f);
     model = glm::translate(model, domeCenter); // fixed world pos
+    if (!cullTest(sceneFrustum, sceneCullStats, domeBounds, model))
+        return;
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    glUniform1f(glGetUniformLocation(shaderProgram, "isFireball"), 0.0f);
-    glUniform1f(glGetUniformLocation(shaderProgram, "hitFlashStrength"), 0.0f);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, domeTexture);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture_diffuse1"), 0);
-
-    glBindVertexArray(domeVAO);
-    glDrawElements(GL_TRIANGLES, domeIndexCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-
-    glCullFace(GL_BACK);
-    glDepthMask(GL_TRUE);
+    // don’t block scene: drawn after it, writing no depth; both faces, as the
+    // dome always drew (model draws had turned face culling off before it)
+    DrawCommand draw;
+    draw.model = model;
+    draw.vao = domeVAO;
+    draw.count = domeIndexCount;
+    draw.indexType = GL_UNSIGNED_INT;
+    draw.depthWrite = false;
+    submitSceneDraw(draw, materialFeatures(domeMaterial), domeMaterial, RENDER_PASS_BACKGROUND, 0.0f);
 }
 
 void setupDome(int stacks = 12, int slices = 24, float radius = 20.0f, float tile = 6.0f)
 {
+    const float params[] = {(float)stacks, (float)slices, radius, tile};
+    uint64_t meshKey = proceduralMeshKey("dome", params, 4);
+    domeBounds = boundsFromBox(vec3(-radius, 0.0f, -radius), vec3(radius));
+    if (useDomeMesh(meshKey))
+    {
+        requestTexture(domeMaterial, "Textures/cave.jpg");
+        return;
+    }
+
     // stacks: vertical bands from top (y=+r) down to equator (y=0)
     // slices: horizontal segments around Y
     // tile: texture tiling factor
@@ -955,45 +2387,31 @@ void setupDome(int stacks = 12, int slices = 24, float radius = 20.0f, float til
 
     glBindVertexArray(0);
 
-    domeTexture = loadTexture("Textures/cave.jpg"); // put your rocky/cave texture there
+    proceduralMeshCache.insert(meshKey, {domeVAO, domeVBO, domeEBO, domeIndexCount},
+                               interleaved.size() * sizeof(float) + indices.size() * sizeof(unsigned int));
+    domeMeshKey = meshKey;
+    requestTexture(domeMaterial, "Textures/cave.jpg"); // put your rocky/cave texture there
 }
 
-void renderDome(GLuint shaderProgram, const glm::mat4 &view, const glm::mat4 &projection)
+void renderDome()
 {
     if (domeVAO == 0 || domeIndexCount == 0)
         return;
 
-    glUseProgram(shaderProgram);
-
-    // Keep depth writes OFF so the dome never blocks scene geometry
-    glDepthMask(GL_FALSE);
-
-    // Cull FRONT faces so we see the inside of the dome
-    glCullFace(GL_FRONT);
-
     glm::mat4 model(1.0f);
     model = glm::translate(model, domeCenter);
     // (radius baked into vertices; no scale here)
+    if (!cullTest(sceneFrustum, sceneCullStats, domeBounds, model))
+        return;
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    // No emissive, no hit flash
-    glUniform1f(glGetUniformLocation(shaderProgram, "isFireball"), 0.0f);
-    glUniform1f(glGetUniformLocation(shaderProgram, "hitFlashStrength"), 0.0f);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, domeTexture);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture_diffuse1"), 0);
-
-    glBindVertexArray(domeVAO);
-    glDrawElements(GL_TRIANGLES, domeIndexCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-
-    // Restore state
-    glCullFace(GL_BACK);
-    glDepthMask(GL_TRUE);
+    // Keep depth writes OFF so the dome never blocks scene geometry
+    DrawCommand draw;
+    draw.model = model;
+    draw.vao = domeVAO;
+    draw.count = domeIndexCount;
+    draw.indexType = GL_UNSIGNED_INT;
+    draw.depthWrite = false;
+    submitSceneDraw(draw, materialFeatures(domeMaterial), domeMaterial, RENDER_PASS_BACKGROUND, 0.0f);
 }
 
 void updateSnakeAnimation(float dt, vec3 camPos)
@@ -1054,6 +2472,78 @@ void updateSnakeAnimation(float dt, vec3 camPos)
     }
 }
 
+// Builds every neck segment's matrices once, picks its LOD in both passes,
+// culls it against both frusta and writes the visible instances to
+// instanceVBO in one upload: the scene pass's runs (one per LOD) first, then
+// the shadow pass's.
+void updateSnakeInstances(const LodView &sceneLodView, const LodView &shadowLodView)
+{
+    static vector<InstanceData> segments, instances;
+    static CullSet boxes;
+    static vector<uint8_t> sceneVisible, shadowVisible;
+    static vector<float> screenPixels, sceneDepth, shadowDepth;
+    segments.resize(SNAKE_NECK_SEGMENTS);
+    screenPixels.resize(SNAKE_NECK_SEGMENTS);
+    sceneDepth.resize(SNAKE_NECK_SEGMENTS);
+    shadowDepth.resize(SNAKE_NECK_SEGMENTS);
+    boxes.clear();
+    float diagonal = fishBody.bounds.radius * 2.0f;
+    for (int i = 0; i < SNAKE_NECK_SEGMENTS; i++)
+    {
+        mat4 m(1.0f);
+        m = translate(m, snakeNeckSegments[i].position);
+        m = rotate(m, radians(45.0f), vec3(1, 0, 0)); // rotate fish to be horizontal
+        m = rotate(m, snakeNeckSegments[i].rotation.x, vec3(1, 0, 0));
+        m = rotate(m, snakeNeckSegments[i].rotation.y, vec3(0, 1, 0));
+        m = rotate(m, snakeNeckSegments[i].rotation.z, vec3(0, 0, 1));
+        m = scale(m, neckScale);
+
+        snakeNeckSegments[i].lod = selectLod(fishBody, m, sceneLodView, snakeNeckSegments[i].lod);
+        snakeNeckSegments[i].shadowLod = selectLod(fishBody, m, shadowLodView, snakeNeckSegments[i].shadowLod);
+        screenPixels[i] = modelPixelsPerUnit(fishBody, m, sceneLodView) * diagonal;
+        sceneDepth[i] = length(snakeNeckSegments[i].position - sceneLodView.eye);
+        shadowDepth[i] = length(snakeNeckSegments[i].position - shadowLodView.eye);
+        segments[i] = {m * fishBody.dequantize, transpose(inverse(mat3(m)))};
+        boxes.add(fishBody.bounds, m);
+    }
+    size_t visibleCount = boxes.cull(sceneFrustum, sceneVisible);
+    sceneCullStats.visible += visibleCount;
+    sceneCullStats.culled += boxes.size() - visibleCount;
+    visibleCount = boxes.cull(shadowFrustum, shadowVisible);
+    shadowCullStats.visible += visibleCount;
+    shadowCullStats.culled += boxes.size() - visibleCount;
+
+    int levels = glm::max((int)fishBody.lods.size(), 1);
+    instances.clear();
+    auto buildRuns = [&](vector<InstanceRun> &runs, bool shadow)
+    {
+        runs.clear();
+        for (int lod = 0; lod < levels; lod++)
+        {
+            InstanceRun run = {lod, (GLint)instances.size(), 0, 0.0f, FLT_MAX};
+            for (int i = 0; i < SNAKE_NECK_SEGMENTS; i++)
+            {
+                int segmentLod = shadow ? snakeNeckSegments[i].shadowLod : snakeNeckSegments[i].lod;
+                if (glm::clamp(segmentLod, 0, levels - 1) != lod || !(shadow ? shadowVisible[i] : sceneVisible[i]))
+                    continue;
+                instances.push_back(segments[i]);
+                run.count++;
+                run.screenPixels = glm::max(run.screenPixels, screenPixels[i]);
+                run.depth = glm::min(run.depth, shadow ? shadowDepth[i] : sceneDepth[i]);
+            }
+            if (run.count > 0)
+                runs.push_back(run);
+        }
+    };
+    buildRuns(snakeSceneRuns, false);
+    buildRuns(snakeShadowRuns, true);
+
+    if (instances.empty())
+        return;
+    reserveInstances(instances.size());
+    uploadBuffer(GL_ARRAY_BUFFER, instanceVBO, instances.data(), instances.size() * sizeof(InstanceData));
+}
+
 bool checkCollision(vec3 projectilePos, vec3 segmentPos, float radius)
 {
     return length(projectilePos - segmentPos) < radius;
@@ -1068,34 +2558,54 @@ void playHitSound()
 #endif
 }
 
-void renderDragonModel(DragonModel &model, GLuint shaderProgram, mat4 modelMatrix, mat4 view, mat4 projection, mat4 lightSpaceMatrix)
+void renderDragonModel(DragonModel &model, mat4 modelMatrix, mat4 view, mat4 projection, int lod)
 {
     if (model.VAO == 0)
     {
         cout << "ERROR: Model VAO is 0!\n";
         return;
     }
-    glUseProgram(shaderProgram);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glDisable(GL_CULL_FACE);
-
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, value_ptr(modelMatrix));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, value_ptr(projection));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, value_ptr(lightSpaceMatrix));
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, model.texture);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture_diffuse1"), 0);
+    // one draw per material batch; textures are assumed to wrap the model
+    // once, so their detail follows its size on screen
+    LodView lodView = {vec3(inverse(view)[3]), HEIGHT * 0.5f * projection[1][1], false};
+    float screenPixels = modelPixelsPerUnit(model, modelMatrix, lodView) * model.bounds.radius * 2.0f;
+    float depth = length(vec3(modelMatrix * vec4(model.bounds.center, 1.0f)) - lodView.eye);
+    // culled models keep noting their texture detail, so turning back to
+    // them does not wait on streaming
+    bool visible = cullTest(sceneFrustum, sceneCullStats, model.bounds, modelMatrix);
+    for (size_t b = 0; b < model.batches.size(); b++)
+    {
+        int material = model.batches[b].material >= 0 ? model.batches[b].material : model.material;
+        noteTextureCoverage(material, screenPixels);
+        if (!visible)
+            continue;
+        DrawCommand draw = dragonModelDraw(model, lod, (int)b);
+        draw.model = modelMatrix;
+        submitSceneDraw(draw, materialFeatures(material), material, RENDER_PASS_OPAQUE, depth);
+    }
+}
 
-    glBindVertexArray(model.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)model.vertices.size());
-    glBindVertexArray(0);
+// Queues a run of instances with the INSTANCED scene variants, one draw per
+// material batch.
+void renderDragonModelInstanced(DragonModel &model, const InstanceRun &run)
+{
+    if (model.VAO == 0)
+    {
+        cout << "ERROR: Model VAO is 0!\n";
+        return;
+    }
+    for (size_t b = 0; b < model.batches.size(); b++)
+    {
+        int material = model.batches[b].material >= 0 ? model.batches[b].material : model.material;
+        noteTextureCoverage(material, run.screenPixels);
+        DrawCommand draw = dragonModelDraw(model, run.lod, (int)b, run.count, run.first);
+        submitSceneDraw(draw, materialFeatures(material) | SHADER_INSTANCED, material, RENDER_PASS_OPAQUE, run.depth);
+    }
 }
 
-void renderStaff(GLuint shaderProgram, mat4 view, mat4 projection, mat4 lightSpaceMatrix)
+void renderStaff(mat4 view, mat4 projection)
 {
-    if (staff.vertices.empty())
+    if (staff.indexCount == 0)
     {
         cout << "Staff has no vertices!\n";
         return;
@@ -1120,39 +2630,15 @@ void renderStaff(GLuint shaderProgram, mat4 view, mat4 projection, mat4 lightSpa
     m = rotate(m, staffRotation.z, vec3(0, 0, 1));
     m = scale(m, staffScale);
 
-    // make staff bioluminescent blue (bright but not full emissive)
-    glUniform1f(glGetUniformLocation(sceneShaderProgram, "isFireball"), 0.7f); // stronger glow for bioluminescence
-    renderDragonModel(staff, shaderProgram, m, view, projection, lightSpaceMatrix);
+    // glows through its material's emissive
+    renderDragonModel(staff, m, view, projection);
 }
 
-void renderSnake(GLuint shaderProgram, mat4 view, mat4 projection, mat4 lightSpaceMatrix)
+void renderSnake(mat4 view, mat4 projection, const LodView &lodView)
 {
-    // Neck
-    for (int i = 0; i < SNAKE_NECK_SEGMENTS; i++)
-    {
-        mat4 m(1.0f);
-        m = translate(m, snakeNeckSegments[i].position);
-        m = rotate(m, radians(45.0f), vec3(1, 0, 0)); // rotate fish to be horizontal
-        m = rotate(m, snakeNeckSegments[i].rotation.x, vec3(1, 0, 0));
-        m = rotate(m, snakeNeckSegments[i].rotation.y, vec3(0, 1, 0));
-        m = rotate(m, snakeNeckSegments[i].rotation.z, vec3(0, 0, 1));
-        m = scale(m, neckScale);
-
-        // hit flash uniforms
-        if (snakeHit)
-        {
-            glUniform3f(glGetUniformLocation(sceneShaderProgram, "hitFlashColor"), 1.0f, 0.0f, 0.0f);
-            glUniform1f(glGetUniformLocation(sceneShaderProgram, "hitFlashStrength"), hitFlashTimer / hitFlashDuration);
-        }
-        else
-        {
-            glUniform1f(glGetUniformLocation(sceneShaderProgram, "hitFlashStrength"), 0.0f);
-        }
-        // ensure not emissive
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "isFireball"), 0.0f);
-
-        renderDragonModel(fishBody, shaderProgram, m, view, projection, lightSpaceMatrix);
-    }
+    // Neck: instances written by updateSnakeInstances()
+    for (const InstanceRun &run : snakeSceneRuns)
+        renderDragonModelInstanced(fishBody, run);
 
     // Head facing camera (direction snake is moving)
     if (SNAKE_NECK_SEGMENTS > 0)
@@ -1197,18 +2683,8 @@ void renderSnake(GLuint shaderProgram, mat4 view, mat4 projection, mat4 lightSpa
         m = rotate(m, relativeYaw, vec3(0, 0, 1));     // then add limited head turn toward camera
         m = scale(m, headScale);
 
-        if (snakeHit)
-        {
-            glUniform3f(glGetUniformLocation(sceneShaderProgram, "hitFlashColor"), 1.0f, 0.0f, 0.0f);
-            glUniform1f(glGetUniformLocation(sceneShaderProgram, "hitFlashStrength"), hitFlashTimer / hitFlashDuration);
-        }
-        else
-        {
-            glUniform1f(glGetUniformLocation(sceneShaderProgram, "hitFlashStrength"), 0.0f);
-        }
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "isFireball"), 0.0f);
-
-        renderDragonModel(dragonHead, shaderProgram, m, view, projection, lightSpaceMatrix);
+        headLod = selectLod(dragonHead, m, lodView, headLod);
+        renderDragonModel(dragonHead, m, view, projection, headLod);
     }
 
 }
@@ -1428,6 +2904,11 @@ int main()
         cout << "Failed to initialize GLEW\n";
         return -1;
     }
+    supportsS3TC = GLEW_EXT_texture_compression_s3tc;
+    supportsBPTC = GLEW_ARB_texture_compression_bptc;
+    if (!uploadRing.create(UPLOAD_RING_BYTES, GLEW_ARB_buffer_storage))
+        uploadRing.create(UPLOAD_RING_BYTES, false);
+    cout << "Upload ring: " << UPLOAD_RING_BYTES / 1024 << " KB, " << (uploadRing.persistent() ? "persistently mapped" : "orphaned on wrap") << endl;
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
@@ -1435,16 +2916,38 @@ int main()
     glFrontFace(GL_CCW);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-    sceneShaderProgram = createShaderProgram("Shaders/scene_vertex_textured.glsl", "Shaders/scene_fragment_textured.glsl");
-    shadowShaderProgram = createShaderProgram("Shaders/shadow_vertex.glsl", "Shaders/shadow_fragment.glsl");
+    // Shaders compile in the driver while the rest of startup runs; nothing
+    // below uses a program until shaderBuilder.finish().
+    ShaderBuilder shaderBuilder(useProgramCache);
+    for (uint32_t features = 0; features < SHADER_VARIANT_COUNT; features++)
+        sceneVariants[features].program = shaderBuilder.submit("Shaders/scene_vertex_textured.glsl", "Shaders/scene_fragment_textured.glsl",
+                                                               shaderVariantDefines(features, SHADOW_PCF_TAPS, MAX_FIREBALLS));
+    shadowShaderProgram = shaderBuilder.submit("Shaders/shadow_vertex.glsl", "Shaders/shadow_fragment.glsl");
+    shadowInstancedProgram = shaderBuilder.submit("Shaders/shadow_vertex.glsl", "Shaders/shadow_fragment.glsl", "#define INSTANCED 1\n");
+    fireballShaderProgram = shaderBuilder.submit("Shaders/fireball_vertex.glsl", "Shaders/fireball_fragment.glsl");
 
     setupShadowMapping();
     setupGround();
     setupCube();
-    setupSphere();
+    setupFireballs();
+    // Models and textures load on worker threads and stream in over the
+    // first frames; placeholders draw until they arrive.
+    double assetLoadStart = glfwGetTime();
+    assetLoader.start();
+    setupMaterials();
+    setupFrameBlocks();
+    setupPlaceholders();
     setupSnakeModels();
     setupDomeGeodesic(/*subdivLevel=*/1, /*radius=*/32.0f, /*tile=*/2.0f);
+    shaderBuilder.finish();
+    ShaderBuildStats shaderStats = shaderBuilder.stats();
+    cout << "Shaders: " << shaderStats.programs << " programs" << (shaderBuilder.parallel() ? " compiled in parallel" : "") << ", "
+         << shaderStats.submitMs << " ms to submit, " << shaderStats.waitMs << " ms waited; program cache " << shaderStats.cacheHits
+         << " hits, " << shaderStats.cacheMisses << " misses, " << shaderStats.savedMs << " ms of compilation skipped" << endl;
+    setupShaderVariants();
+    size_t startupUniformLookups = uniformStats().lookups;
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // pure black for cave atmosphere
+    bool firstFrame = true, assetsLoaded = false;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -1452,6 +2955,16 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        uploadRing.retire();
+        assetLoader.pump(ASSET_UPLOAD_BUDGET);
+        streamMaterialLayers(TEXTURE_STREAM_BUDGET);
+        if (!assetsLoaded && assetLoader.idle())
+        {
+            assetsLoaded = true;
+            cout << "All assets loaded " << (glfwGetTime() - assetLoadStart) * 1000.0 << " ms after startup" << endl;
+            printUploadRingStats();
+        }
+
         processInput(window);
         updateSnakeAnimation(deltaTime, cameraPos);
 
@@ -1459,134 +2972,160 @@ int main()
         lightPos.x = 15.0f * cos(currentFrame * 0.5f);
         lightPos.z = 15.0f * sin(currentFrame * 0.5f);
 
-        // ---------- Shadow pass ----------
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-
         mat4 lightProjection = ortho(-20.0f, 20.0f, -20.0f, 20.0f, 1.0f, 50.0f);
         mat4 lightView = lookAt(lightPos, vec3(0.0f), vec3(0, 1, 0));
         mat4 lightSpaceMatrix = lightProjection * lightView;
+        mat4 projection = perspective(radians(45.0f), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
+        mat4 view = lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
 
-        glUseProgram(shadowShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, value_ptr(lightSpaceMatrix));
+        // ---------- Frame and light blocks, shared by both passes ----------
+        frameData.view = view;
+        frameData.projection = projection;
+        frameData.lightSpaceMatrix = lightSpaceMatrix;
+        frameData.viewPos = cameraPos;
+        frameData.time = currentFrame;
+        frameData.lightPos = lightPos;
+        frameData.deltaTime = deltaTime;
+        frameData.lightColor = vec4(lightColor, 1.0f);
+        {
+            // staff blue light with reduced intensity for smaller effective radius
+            vec3 rightVector = normalize(cross(cameraFront, cameraUp));
+            vec3 staffWorldPos = cameraPos + cameraFront * 3.0f + rightVector * 1.2f + cameraUp * (-0.8f);
+            int lightCount = 0;
+            lightData.fireballs[lightCount++] = {vec4(staffWorldPos, 1.0f), vec4(0.4f, 0.8f, 1.5f, 0.0f)};
+            // fireball lights, bright orange
+            for (auto &p : projectileList)
+            {
+                if (lightCount == MAX_FIREBALLS)
+                    break;
+                lightData.fireballs[lightCount++] = {vec4(p.getPosition(), 1.0f), vec4(4.5f, 2.2f, 1.2f, 0.0f)};
+            }
+            lightData.fireballCount = lightCount;
+            lightData.fireballRadius = 3.5f;
+        }
+        updateFrameBlocks();
+
+        // ---------- Shadow pass (queued) ----------
+        // shadow map texels per world unit (ortho box is 40 units wide)
+        LodView shadowLodView = {lightPos, SHADOW_WIDTH / 40.0f, true};
+        // pixels covered by one world unit at distance 1
+        LodView sceneLodView = {cameraPos, HEIGHT / (2.0f * tan(radians(45.0f) * 0.5f)), false};
+        lodTrianglesDrawn = lodTrianglesFull = modelDrawCalls = instancesDrawn = 0;
+        sceneFrustum = frustumFromMatrix(projection * view);
+        shadowFrustum = frustumFromMatrix(lightSpaceMatrix);
+        sceneCullStats = shadowCullStats = CullStats();
+        updateSnakeInstances(sceneLodView, shadowLodView);
 
         mat4 groundModel(1.0f);
         // simple shadow pass for ground: reuse ground VAO with identity model
-        glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgram, "model"), 1, GL_FALSE, value_ptr(groundModel));
-        glBindVertexArray(groundVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-
-        // snake body
-        for (int i = 0; i < SNAKE_NECK_SEGMENTS; i++)
+        if (cullTest(shadowFrustum, shadowCullStats, groundBounds, groundModel))
         {
-            mat4 bodyModel(1.0f);
-            bodyModel = translate(bodyModel, snakeNeckSegments[i].position);
-            bodyModel = scale(bodyModel, neckScale);
-            glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgram, "model"), 1, GL_FALSE, value_ptr(bodyModel));
-            glBindVertexArray(fishBody.VAO);
-            glDrawArrays(GL_TRIANGLES, 0, (GLsizei)fishBody.vertices.size());
+            DrawCommand groundShadow;
+            groundShadow.vao = groundVAO;
+            groundShadow.count = 6;
+            submitShadowDraw(groundShadow, shadowShaderProgram, length(lightPos));
         }
+
+        // snake body: one instanced draw per LOD run
+        for (const InstanceRun &run : snakeShadowRuns)
+            submitShadowDraw(dragonModelDraw(fishBody, run.lod, -1, run.count, run.first), shadowInstancedProgram, run.depth);
         // head
         if (SNAKE_NECK_SEGMENTS > 0)
         {
             mat4 headModel(1.0f);
             headModel = translate(headModel, snakeNeckSegments[SNAKE_NECK_SEGMENTS - 1].position);
             headModel = scale(headModel, headScale);
-            glUniformMatrix4fv(glGetUniformLocation(shadowShaderProgram, "model"), 1, GL_FALSE, value_ptr(headModel));
-            glBindVertexArray(dragonHead.VAO);
-            glDrawArrays(GL_TRIANGLES, 0, (GLsizei)dragonHead.vertices.size());
+            headShadowLod = selectLod(dragonHead, headModel, shadowLodView, headShadowLod);
+            if (cullTest(shadowFrustum, shadowCullStats, dragonHead.bounds, headModel))
+            {
+                DrawCommand headShadow = dragonModelDraw(dragonHead, headShadowLod);
+                headShadow.model = headModel;
+                submitShadowDraw(headShadow, shadowShaderProgram, length(vec3(headModel[3]) - lightPos));
+            }
         }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        // ---------- Scene pass ----------
-        glViewport(0, 0, WIDTH, HEIGHT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        mat4 projection = perspective(radians(45.0f), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
-        mat4 view = lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-
-        glUseProgram(sceneShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(sceneShaderProgram, "projection"), 1, GL_FALSE, value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(sceneShaderProgram, "view"), 1, GL_FALSE, value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(sceneShaderProgram, "lightSpaceMatrix"), 1, GL_FALSE, value_ptr(lightSpaceMatrix));
-
-        glUniform3fv(glGetUniformLocation(sceneShaderProgram, "lightPos"), 1, value_ptr(lightPos));
-        glUniform3fv(glGetUniformLocation(sceneShaderProgram, "lightColor"), 1, value_ptr(lightColor));
-        glUniform3fv(glGetUniformLocation(sceneShaderProgram, "viewPos"), 1, value_ptr(cameraPos));
+        // ---------- Scene pass (queued) ----------
+        // hit flash is a material parameter; the opaque pass binds materials
+        float hitFlash = snakeHit ? hitFlashTimer / hitFlashDuration : 0.0f;
+        setMaterialHitFlash(fishBody, vec3(1.0f, 0.0f, 0.0f), hitFlash);
+        setMaterialHitFlash(dragonHead, vec3(1.0f, 0.0f, 0.0f), hitFlash);
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-        glUniform1i(glGetUniformLocation(sceneShaderProgram, "shadowMap"), 1);
-        // Dark cave atmosphere - some ambient light for visibility
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "uAmbient"), 0.3f); // more ambient for cave
-        // (If you didn’t add uAmbient earlier, either add it as in my prior message or skip. Cave still works without it.)
+        // Draw world
+        renderGround(groundModel, view, projection);
+        renderSnake(view, projection, sceneLodView);
+        renderStaff(view, projection);
 
-        // ---- upload fireball point lights (single pass) ----
-        {
-            vector<vec3> fbPos;
-            fbPos.reserve(MAX_FIREBALLS);
-            vector<vec3> fbCol;
-            fbCol.reserve(MAX_FIREBALLS);
+        // Fireballs: sphere impostors, one draw for all of them
+        renderFireballs();
 
-            // Add staff blue light with reduced intensity for smaller effective radius
-            vec3 rightVector = normalize(cross(cameraFront, cameraUp));
-            vec3 staffWorldPos = cameraPos + cameraFront * 3.0f + rightVector * 1.2f + cameraUp * (-0.8f);
-            fbPos.push_back(staffWorldPos);
-            fbCol.push_back(vec3(0.4f, 0.8f, 1.5f)); // dimmer blue for smaller effective range
+        // Dome in the background pass, after everything (no depth writes)
+        renderDomeGeodesic();
 
-            // Add fireball lights
-            for (auto &p : projectileList)
-            {
-                fbPos.push_back(p.getPosition());
-                fbCol.push_back(vec3(4.5f, 2.2f, 1.2f)); // bright orange
-                if ((int)fbPos.size() == MAX_FIREBALLS)
-                    break;
-            }
-            glUniform1i(glGetUniformLocation(sceneShaderProgram, "uFireballCount"), (int)fbPos.size());
-            if (!fbPos.empty())
-            {
-                glUniform3fv(glGetUniformLocation(sceneShaderProgram, "uFireballPos"), (GLsizei)fbPos.size(), &fbPos[0].x);
-                glUniform3fv(glGetUniformLocation(sceneShaderProgram, "uFireballColor"), (GLsizei)fbCol.size(), &fbCol[0].x);
-            }
-            glUniform1f(glGetUniformLocation(sceneShaderProgram, "uFireballRadius"), 3.5f); // back to single radius
-        }
+        flushRenderQueue();
 
-        // Ensure default flags for non-fireball draws
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "hitFlashStrength"), 0.0f);
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "isFireball"), 0.0f);
+        // NOTE: removed the old additive re-render pass entirely (not needed)
 
-        // Draw world
-        renderGround(sceneShaderProgram, groundModel, view, projection);
-        renderSnake(sceneShaderProgram, view, projection, lightSpaceMatrix);
-        // reset flash for other objects
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "hitFlashStrength"), 0.0f);
-        glUniform1f(glGetUniformLocation(sceneShaderProgram, "isFireball"), 0.0f);
-        renderStaff(sceneShaderProgram, view, projection, lightSpaceMatrix);
-
-        // Draw fireball meshes (emissive spheres)
-        for (auto &projectile : projectileList)
+        // LOD readout (shadow + scene pass)
+        static int lodDebugCounter = 0;
+        if (lodDebugCounter++ % 120 == 0)
         {
-            projectile.Draw(sceneShaderProgram, view, projection);
+            cout << "Model triangles: " << lodTrianglesDrawn << " drawn / " << lodTrianglesFull << " at full detail, "
+                 << modelDrawCalls << " draw calls, " << instancesDrawn << " instanced, " << fireballsDrawn << " fireballs"
+                 << " (head LOD " << headLod << ", tail LOD " << snakeNeckSegments[0].lod << ")" << endl;
+            UniformStats uniforms = uniformStats();
+            cout << "Uniforms: " << uniforms.uploads << " uploads, " << uniforms.skipped << " unchanged, "
+                 << uniforms.lookups - startupUniformLookups << " name lookups since startup" << endl;
+            const GLStateStats &state = glState.stats();
+            cout << "Render queue: " << renderPackets << " packets, " << state.totalIssued() << " of " << state.totalSubmitted()
+                 << " state changes issued (";
+            for (int kind = 0; kind < GL_STATE_KIND_COUNT; kind++)
+                cout << (kind ? ", " : "") << glStateKindName((GLStateKind)kind) << " " << state.issued[kind] << "/"
+                     << state.submitted[kind];
+            cout << ")" << endl;
+            cout << "Culling: scene " << sceneCullStats.visible << " visible / " << sceneCullStats.culled << " culled, shadow "
+                 << shadowCullStats.visible << " visible / " << shadowCullStats.culled << " culled" << endl;
         }
 
-        // Draw dome LAST so it appears behind everything (depth disabled)
-        renderDomeGeodesic(sceneShaderProgram, view, projection);
-
-        // NOTE: removed the old additive re-render pass entirely (not needed)
-
+        uploadRing.fence();
         glfwSwapBuffers(window);
         glfwPollEvents();
+        if (firstFrame)
+        {
+            firstFrame = false;
+            cout << "First frame " << (glfwGetTime() - assetLoadStart) * 1000.0 << " ms after asset requests" << endl;
+        }
     }
 
     // Cleanup
+    assetLoader.stop();
+    cout << "Shared assets: " << layerCache.size() << " material layers (" << layerCache.hits() << " reused, "
+         << layerCache.sharedBytes() / 1024 << " KB not uploaded), " << modelMeshCache.size() << " model meshes ("
+         << modelMeshCache.hits() << " reused, " << modelMeshCache.sharedBytes() / 1024 << " KB not uploaded)" << endl;
+    cout << "Texture streaming: " << textureStreamBytes / 1024 << " KB of finer levels uploaded on demand" << endl;
+    printUploadRingStats();
+    releaseDragonModel(dragonHead);
+    releaseDragonModel(fishBody);
+    releaseDragonModel(staff);
+    releaseLayer(materials[domeMaterial].layer[0]);
+    releaseProceduralMesh(domeMeshKey);
     glDeleteVertexArrays(1, &groundVAO);
     glDeleteBuffers(1, &groundVBO);
-    glDeleteProgram(sceneShaderProgram);
+    for (SceneVariant &variant : sceneVariants)
+        glDeleteProgram(variant.program);
     glDeleteProgram(shadowShaderProgram);
+    glDeleteProgram(shadowInstancedProgram);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteProgram(fireballShaderProgram);
+    glDeleteVertexArrays(1, &fireballVAO);
+    glDeleteBuffers(1, &fireballQuadVBO);
+    glDeleteBuffers(1, &fireballInstanceVBO);
     glDeleteFramebuffers(1, &depthMapFBO);
     glDeleteTextures(1, &depthMap);
+    glDeleteTextures(1, &materialArray);
+    glDeleteBuffers(1, &materialUBO);
+    glDeleteBuffers(1, &frameUBO);
+    glDeleteBuffers(1, &lightUBO);
+    uploadRing.destroy();
 
     glfwTerminate();
     return 0;
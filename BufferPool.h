@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Thread-safe recycler for large heap blocks such as decoded pixels and image
+// decoder scratch. Freed blocks are kept on per-size-class free lists (four
+// classes per power of two, so at most 25% slack) and handed out again
+// instead of going back to malloc, which for blocks this size means mmap,
+// page faults on first touch, and munmap on every image. Blocks under
+// MIN_POOLED_BYTES, or past the cap on cached bytes, use malloc/free directly.
+class BufferPool
+{
+public:
+    static const size_t MIN_POOLED_BYTES = 4096;
+
+    explicit BufferPool(size_t maxCachedBytes = 64u << 20) : mMaxCachedBytes(maxCachedBytes) {}
+    ~BufferPool() { trim(); }
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    void *allocate(size_t size)
+    {
+        uint32_t sizeClass = classFor(size);
+        if (sizeClass != UNPOOLED)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            std::vector<Header *> &list = mFree[sizeClass];
+            if (!list.empty())
+            {
+                Header *header = list.back();
+                list.pop_back();
+                mCachedBytes -= classBytes(sizeClass);
+                mReused++;
+                return header + 1;
+            }
+        }
+        size_t capacity = sizeClass == UNPOOLED ? size : classBytes(sizeClass);
+        Header *header = (Header *)malloc(sizeof(Header) + capacity);
+        if (!header)
+            return nullptr;
+        header->sizeClass = sizeClass;
+        header->capacity = capacity;
+        return header + 1;
+    }
+
+    void release(void *block)
+    {
+        if (!block)
+            return;
+        Header *header = (Header *)block - 1;
+        if (header->sizeClass != UNPOOLED)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mCachedBytes + header->capacity <= mMaxCachedBytes)
+            {
+                mFree[header->sizeClass].push_back(header);
+                mCachedBytes += header->capacity;
+                return;
+            }
+        }
+        free(header);
+    }
+
+    void *reallocate(void *block, size_t size)
+    {
+        if (!block)
+            return allocate(size);
+        Header *header = (Header *)block - 1;
+        if (size <= header->capacity)
+            return block;
+        void *grown = allocate(size);
+        if (grown)
+        {
+            memcpy(grown, block, header->capacity);
+            release(block);
+        }
+        return grown;
+    }
+
+    // Frees every cached block.
+    void trim()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (std::vector<Header *> &list : mFree)
+        {
+            for (Header *header : list)
+                free(header);
+            list.clear();
+        }
+        mCachedBytes = 0;
+    }
+
+    size_t reused() const { return mReused; }
+    size_t cachedBytes() const { return mCachedBytes; }
+
+private:
+    struct alignas(16) Header
+    {
+        uint32_t sizeClass;
+        size_t capacity;
+    };
+    static const uint32_t UNPOOLED = ~0u;
+    static const uint32_t CLASS_COUNT = 4 * 48;
+
+    // Class 4e + m holds (4 + m) << (e - 2) bytes.
+    static size_t classBytes(uint32_t sizeClass)
+    {
+        return (size_t)(4 + sizeClass % 4) << (sizeClass / 4 - 2);
+    }
+
+    static uint32_t classFor(size_t size)
+    {
+        if (size < MIN_POOLED_BYTES)
+            return UNPOOLED;
+        uint32_t e = 0;
+        while ((size >> e) > 1)
+            e++;
+        size_t step = (size_t)1 << (e - 2);
+        size_t m = (size - ((size_t)1 << e) + step - 1) / step;
+        uint32_t sizeClass = 4 * e + (uint32_t)m; // m == 4 rolls over into the next power
+        return sizeClass < CLASS_COUNT ? sizeClass : UNPOOLED;
+    }
+
+    std::mutex mMutex;
+    std::vector<Header *> mFree[CLASS_COUNT];
+    size_t mCachedBytes = 0;
+    size_t mMaxCachedBytes;
+    size_t mReused = 0;
+};
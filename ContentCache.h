@@ -0,0 +1,88 @@
+#pragma once
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+// Reference-counted table of built assets (GL textures, buffers, ...) keyed by
+// a 64-bit content hash of what they were built from: file bytes for loaded
+// assets, generator parameters for procedural ones. Requests for identical
+// content share one object; the owner frees it when release() reports the
+// last reference gone. Lookups take a mutex so worker threads can ask
+// contains() before doing expensive work; creating and freeing the objects
+// themselves stays with the caller (the GL thread).
+template <typename Value>
+class ContentCache
+{
+public:
+    // Takes a reference to the entry for key and copies its value out.
+    bool acquire(uint64_t key, Value &value)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntries.find(key);
+        if (it == mEntries.end())
+            return false;
+        it->second.refs++;
+        mSharedBytes += it->second.bytes;
+        mHits++;
+        value = it->second.value;
+        return true;
+    }
+
+    // Adds a new entry holding one reference. bytes is its (approximate)
+    // memory cost, used for the statistics.
+    void insert(uint64_t key, const Value &value, size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Entry &entry = mEntries[key];
+        entry.value = value;
+        entry.bytes = bytes;
+        entry.refs = 1;
+        mUniqueBytes += bytes;
+    }
+
+    // Drops one reference. Returns true, with the value, when it was the last
+    // one and the caller should free the object.
+    bool release(uint64_t key, Value &value)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntries.find(key);
+        if (it == mEntries.end() || --it->second.refs > 0)
+            return false;
+        value = it->second.value;
+        mUniqueBytes -= it->second.bytes;
+        mEntries.erase(it);
+        return true;
+    }
+
+    bool contains(uint64_t key) const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mEntries.count(key) != 0;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mEntries.size();
+    }
+
+    // Bytes held by live entries, and bytes that hits did not have to build.
+    size_t uniqueBytes() const { return mUniqueBytes; }
+    size_t sharedBytes() const { return mSharedBytes; }
+    size_t hits() const { return mHits; }
+
+private:
+    struct Entry
+    {
+        Value value;
+        size_t bytes = 0;
+        uint32_t refs = 0;
+    };
+    mutable std::mutex mMutex;
+    std::unordered_map<uint64_t, Entry> mEntries;
+    size_t mUniqueBytes = 0;
+    size_t mSharedBytes = 0;
+    size_t mHits = 0;
+};
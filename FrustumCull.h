@@ -0,0 +1,201 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_CULL_SSE2 1
+#endif
+
+// View-frustum culling. Drawables carry Bounds computed once at import (box
+// and sphere in object space); per instance the box is moved to world space
+// as a center and half extents, and a box is culled when it lies entirely
+// behind one of the six frustum planes. Perspective and orthographic
+// (shadow map) frusta come out of the same matrix extraction.
+//
+// CullSet keeps boxes in structure-of-arrays form, so the SSE2 kernel tests
+// four boxes against a plane with a handful of instructions; the result is a
+// conservative test (boxes near a frustum corner may be kept), never a wrong
+// rejection.
+
+struct Bounds
+{
+    glm::vec3 min = glm::vec3(0.0f), max = glm::vec3(0.0f); // axis-aligned box
+    glm::vec3 center = glm::vec3(0.0f);                     // bounding sphere
+    float radius = 0.0f;
+};
+
+inline Bounds boundsFromBox(const glm::vec3 &min, const glm::vec3 &max)
+{
+    Bounds bounds;
+    bounds.min = min;
+    bounds.max = max;
+    bounds.center = (min + max) * 0.5f;
+    bounds.radius = glm::length(max - min) * 0.5f;
+    return bounds;
+}
+
+inline Bounds boundsFromSphere(const glm::vec3 &center, float radius)
+{
+    Bounds bounds;
+    bounds.min = center - glm::vec3(radius);
+    bounds.max = center + glm::vec3(radius);
+    bounds.center = center;
+    bounds.radius = radius;
+    return bounds;
+}
+
+// World box of bounds under an affine model matrix: the center transforms as
+// a point, the half extents by the absolute value of the linear part.
+inline void worldBox(const Bounds &bounds, const glm::mat4 &model, glm::vec3 &center, glm::vec3 &extent)
+{
+    glm::vec3 half = (bounds.max - bounds.min) * 0.5f;
+    center = glm::vec3(model * glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f));
+    extent = glm::abs(glm::vec3(model[0])) * half.x + glm::abs(glm::vec3(model[1])) * half.y +
+             glm::abs(glm::vec3(model[2])) * half.z;
+}
+
+// Planes with inward normals: dot(xyz, p) + w >= 0 inside.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+// Extracts the planes of a (projection * view) matrix, left, right, bottom,
+// top, near, far.
+inline Frustum frustumFromMatrix(const glm::mat4 &m)
+{
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0];
+    frustum.planes[1] = row[3] - row[0];
+    frustum.planes[2] = row[3] + row[1];
+    frustum.planes[3] = row[3] - row[1];
+    frustum.planes[4] = row[3] + row[2];
+    frustum.planes[5] = row[3] - row[2];
+    for (glm::vec4 &plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+// One box, for drawables tested on their own.
+inline bool frustumContainsBox(const Frustum &frustum, const glm::vec3 &center, const glm::vec3 &extent)
+{
+    for (const glm::vec4 &plane : frustum.planes)
+    {
+        glm::vec3 normal(plane);
+        if (glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extent) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+struct CullStats
+{
+    size_t visible = 0;
+    size_t culled = 0;
+};
+
+class CullSet
+{
+public:
+    void clear()
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mCenter[axis].clear();
+            mExtent[axis].clear();
+        }
+        mCount = 0;
+    }
+
+    size_t size() const { return mCount; }
+
+    // Adds a world box and returns its index.
+    size_t add(const glm::vec3 &center, const glm::vec3 &extent)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mCenter[axis].push_back(center[axis]);
+            mExtent[axis].push_back(extent[axis]);
+        }
+        return mCount++;
+    }
+
+    size_t add(const Bounds &bounds, const glm::mat4 &model)
+    {
+        glm::vec3 center, extent;
+        worldBox(bounds, model, center, extent);
+        return add(center, extent);
+    }
+
+    // Sets visible[i] to 1 for every box at least partly inside frustum and 0
+    // for the rest; returns the number visible.
+    size_t cull(const Frustum &frustum, std::vector<uint8_t> &visible)
+    {
+        // pad to whole groups of four with empty boxes at the origin
+        size_t padded = (mCount + 3) & ~(size_t)3;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mCenter[axis].resize(padded, 0.0f);
+            mExtent[axis].resize(padded, 0.0f);
+        }
+        visible.resize(padded);
+        size_t count = 0;
+        for (size_t i = 0; i < padded; i += 4)
+        {
+            int outside = outsideMask(frustum, i);
+            for (size_t k = 0; k < 4; k++)
+                visible[i + k] = (outside >> k & 1) ? 0 : 1;
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            mCenter[axis].resize(mCount);
+            mExtent[axis].resize(mCount);
+        }
+        visible.resize(mCount);
+        for (uint8_t v : visible)
+            count += v;
+        return count;
+    }
+
+private:
+    // Bit k set: box i + k is behind some plane.
+    int outsideMask(const Frustum &frustum, size_t i) const
+    {
+#ifdef FRUSTUM_CULL_SSE2
+        __m128 cx = _mm_loadu_ps(&mCenter[0][i]), cy = _mm_loadu_ps(&mCenter[1][i]), cz = _mm_loadu_ps(&mCenter[2][i]);
+        __m128 ex = _mm_loadu_ps(&mExtent[0][i]), ey = _mm_loadu_ps(&mExtent[1][i]), ez = _mm_loadu_ps(&mExtent[2][i]);
+        __m128 outside = _mm_setzero_ps();
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            // distance of the center, plus the box's reach towards the plane
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                  _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey)),
+                                  _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+        return _mm_movemask_ps(outside);
+#else
+        int outside = 0;
+        for (size_t k = 0; k < 4; k++)
+        {
+            glm::vec3 center(mCenter[0][i + k], mCenter[1][i + k], mCenter[2][i + k]);
+            glm::vec3 extent(mExtent[0][i + k], mExtent[1][i + k], mExtent[2][i + k]);
+            if (!frustumContainsBox(frustum, center, extent))
+                outside |= 1 << k;
+        }
+        return outside;
+#endif
+    }
+
+    std::vector<float> mCenter[3], mExtent[3];
+    size_t mCount = 0;
+};
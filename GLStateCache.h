@@ -0,0 +1,164 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+
+// Shadows the GL state the render queue changes between draws and only
+// issues a call when the value actually changes. Every request counts as
+// submitted, every call that reaches GL as issued, per kind of state, so a
+// frame can report how much the sort and the filter saved. Code outside the
+// cache that touches the same state must be followed by invalidate().
+
+enum GLStateKind
+{
+    GL_STATE_PROGRAM,
+    GL_STATE_VERTEX_ARRAY,
+    GL_STATE_TEXTURE, // active unit and binding
+    GL_STATE_CULL,
+    GL_STATE_DEPTH,   // test and write mask
+    GL_STATE_POLYGON_MODE,
+    GL_STATE_KIND_COUNT
+};
+
+inline const char *glStateKindName(GLStateKind kind)
+{
+    static const char *names[GL_STATE_KIND_COUNT] = {"programs", "VAOs", "textures", "cull", "depth", "polygon mode"};
+    return names[kind];
+}
+
+struct GLStateStats
+{
+    size_t submitted[GL_STATE_KIND_COUNT] = {};
+    size_t issued[GL_STATE_KIND_COUNT] = {};
+
+    size_t totalSubmitted() const
+    {
+        size_t total = 0;
+        for (size_t count : submitted)
+            total += count;
+        return total;
+    }
+    size_t totalIssued() const
+    {
+        size_t total = 0;
+        for (size_t count : issued)
+            total += count;
+        return total;
+    }
+};
+
+class GLStateCache
+{
+public:
+    static const GLuint MAX_TEXTURE_UNITS = 16;
+
+    // Forgets every value, so the next request of each state is issued.
+    void invalidate()
+    {
+        mProgram.known = mVertexArray.known = mActiveUnit.known = false;
+        mCullEnabled.known = mCullFace.known = mDepthTest.known = mDepthMask.known = mPolygonMode.known = false;
+        for (Cached<GLuint> &texture : mTextures)
+            texture.known = false;
+    }
+
+    void useProgram(GLuint program)
+    {
+        if (change(GL_STATE_PROGRAM, mProgram, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vertexArray)
+    {
+        if (change(GL_STATE_VERTEX_ARRAY, mVertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // Binds texture to target on unit. A unit remembers one target: binding
+    // another target there is issued even if it was bound before.
+    void bindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        if (unit >= MAX_TEXTURE_UNITS)
+        {
+            activeTexture(unit);
+            glBindTexture(target, texture);
+            return;
+        }
+        mStats.submitted[GL_STATE_TEXTURE]++;
+        Cached<GLuint> &bound = mTextures[unit];
+        if (bound.known && bound.value == texture && mTargets[unit] == target)
+            return;
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        mStats.issued[GL_STATE_TEXTURE]++;
+        bound.known = true;
+        bound.value = texture;
+        mTargets[unit] = target;
+    }
+
+    void setCullFace(bool enabled, GLenum face = GL_BACK)
+    {
+        if (change(GL_STATE_CULL, mCullEnabled, enabled))
+            enabled ? glEnable(GL_CULL_FACE) : glDisable(GL_CULL_FACE);
+        if (enabled && change(GL_STATE_CULL, mCullFace, face))
+            glCullFace(face);
+    }
+
+    void setDepthTest(bool enabled)
+    {
+        if (change(GL_STATE_DEPTH, mDepthTest, enabled))
+            enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+    }
+
+    void setDepthMask(bool write)
+    {
+        if (change(GL_STATE_DEPTH, mDepthMask, write))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void setPolygonMode(GLenum mode)
+    {
+        if (change(GL_STATE_POLYGON_MODE, mPolygonMode, mode))
+            glPolygonMode(GL_FRONT_AND_BACK, mode);
+    }
+
+    const GLStateStats &stats() const { return mStats; }
+    void resetStats() { mStats = GLStateStats(); }
+
+private:
+    template <typename T>
+    struct Cached
+    {
+        T value = T();
+        bool known = false;
+    };
+
+    template <typename T>
+    bool change(GLStateKind kind, Cached<T> &cached, T value)
+    {
+        mStats.submitted[kind]++;
+        if (cached.known && cached.value == value)
+            return false;
+        cached.value = value;
+        cached.known = true;
+        mStats.issued[kind]++;
+        return true;
+    }
+
+    // counted with the binding it precedes
+    void activeTexture(GLuint unit)
+    {
+        if (mActiveUnit.known && mActiveUnit.value == unit)
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        mActiveUnit.value = unit;
+        mActiveUnit.known = true;
+    }
+
+    Cached<GLuint> mProgram, mVertexArray, mActiveUnit;
+    Cached<GLuint> mTextures[MAX_TEXTURE_UNITS];
+    GLenum mTargets[MAX_TEXTURE_UNITS] = {};
+    Cached<bool> mCullEnabled, mDepthTest, mDepthMask;
+    Cached<GLenum> mCullFace, mPolygonMode;
+    GLStateStats mStats;
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Interleaved vertex matching the scene shaders' attribute locations:
+// 0 = position, 1 = normal, 2 = uv.
+struct MeshVertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
+static_assert(sizeof(MeshVertex) == 32, "MeshVertex must stay tightly packed");
+
+// One level of detail: a range of IndexedMesh::indices. error is the
+// geometric deviation from level 0, in mesh units.
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+struct MeshRange
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+// Triangles sharing one material. lods[i] is the batch's part of level i; the
+// batches of a level are contiguous, so a level can also be drawn in one call.
+struct MeshBatch
+{
+    uint32_t material;
+    std::string diffuseTexture; // path of the material's texture, empty if none
+    std::vector<MeshRange> lods;
+};
+
+// Compact vertex array plus triangle list for glDrawElements.
+struct IndexedMesh
+{
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<MeshLod> lods;       // empty: a single level covering all indices
+    std::vector<MeshBatch> batches;  // empty: a single batch covering each level
+
+    // True when every index fits a GL_UNSIGNED_SHORT index buffer.
+    bool fitsShortIndices() const { return vertices.size() <= 0xFFFF; }
+};
+
+inline uint64_t hashMix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Hashes the raw bytes of a small POD key, 4 bytes at a time.
+template <typename Key>
+struct PodHasher
+{
+    uint64_t operator()(const Key &key) const
+    {
+        static_assert(sizeof(Key) % 4 == 0, "key size must be a multiple of 4");
+        uint32_t words[sizeof(Key) / 4];
+        memcpy(words, &key, sizeof(Key));
+        uint64_t h = 0x9E3779B97F4A7C15ULL;
+        for (uint32_t w : words)
+            h = hashMix64(h ^ w);
+        return h;
+    }
+};
+
+// Open-addressing (linear probing) map from a POD key to a dense id. The table
+// is sized once from the maximum number of keys, so it never rehashes and the
+// load factor stays at or below 1/2. Keys are compared bytewise, which is what
+// welding wants: two corners are the same vertex only if every attribute is.
+template <typename Key, typename Hasher = PodHasher<Key>>
+class VertexWelder
+{
+public:
+    explicit VertexWelder(size_t maxKeys)
+    {
+        size_t capacity = 16;
+        while (capacity < maxKeys * 2)
+            capacity <<= 1;
+        mMask = capacity - 1;
+        mTable.assign(capacity, Empty);
+        mKeys.reserve(maxKeys);
+    }
+
+    // Returns the id of key, assigning the next free id on first sight.
+    uint32_t insert(const Key &key)
+    {
+        size_t slot = (size_t)Hasher()(key) & mMask;
+        while (true)
+        {
+            uint32_t id = mTable[slot];
+            if (id == Empty)
+            {
+                id = (uint32_t)mKeys.size();
+                mTable[slot] = id;
+                mKeys.push_back(key);
+                return id;
+            }
+            if (memcmp(&mKeys[id], &key, sizeof(Key)) == 0)
+                return id;
+            slot = (slot + 1) & mMask;
+        }
+    }
+
+    const std::vector<Key> &keys() const { return mKeys; }
+
+private:
+    static constexpr uint32_t Empty = 0xFFFFFFFFu;
+    std::vector<uint32_t> mTable;
+    std::vector<Key> mKeys;
+    size_t mMask = 0;
+};
+
+// Welds identical vertices of source[0..count). remap[i] receives the id of
+// source[i] in outVertices.
+inline void weldVertices(const MeshVertex *source, size_t count, std::vector<MeshVertex> &outVertices, std::vector<uint32_t> &remap)
+{
+    VertexWelder<MeshVertex> welder(count);
+    remap.resize(count);
+    for (size_t i = 0; i < count; i++)
+        remap[i] = welder.insert(source[i]);
+    outVertices = welder.keys();
+}
+
+// Builds an indexed mesh from an unindexed triangle list.
+inline void weldTriangles(const std::vector<MeshVertex> &corners, IndexedMesh &out)
+{
+    weldVertices(corners.data(), corners.size(), out.vertices, out.indices);
+}
+
+// Axis-aligned bounds of the vertex positions (zero for an empty mesh).
+inline void computeBounds(const IndexedMesh &mesh, glm::vec3 &boundsMin, glm::vec3 &boundsMax)
+{
+    if (mesh.vertices.empty())
+    {
+        boundsMin = boundsMax = glm::vec3(0.0f);
+        return;
+    }
+    boundsMin = boundsMax = mesh.vertices[0].position;
+    for (const MeshVertex &v : mesh.vertices)
+    {
+        boundsMin = glm::min(boundsMin, v.position);
+        boundsMax = glm::max(boundsMax, v.position);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. The mapping lives as long as the object, so
+// parsers can walk [data, data + size) without copying the file into memory.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    explicit MappedFile(const char *path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const char *path)
+    {
+        close();
+#ifdef _WIN32
+        mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (mFile == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(mFile, &fileSize))
+        {
+            close();
+            return false;
+        }
+        mSize = (size_t)fileSize.QuadPart;
+        mOpen = true;
+        if (mSize == 0)
+            return true; // empty files cannot be mapped, but are valid
+        mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mMapping)
+        {
+            close();
+            return false;
+        }
+        mData = (const char *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!mData)
+        {
+            close();
+            return false;
+        }
+#else
+        mFd = ::open(path, O_RDONLY);
+        if (mFd < 0)
+            return false;
+        struct stat st;
+        if (fstat(mFd, &st) != 0)
+        {
+            close();
+            return false;
+        }
+        mSize = (size_t)st.st_size;
+        mOpen = true;
+        if (mSize == 0)
+            return true;
+        void *ptr = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        madvise(ptr, mSize, MADV_SEQUENTIAL);
+        mData = (const char *)ptr;
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (mData)
+            UnmapViewOfFile(mData);
+        if (mMapping)
+            CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE)
+            CloseHandle(mFile);
+        mMapping = NULL;
+        mFile = INVALID_HANDLE_VALUE;
+#else
+        if (mData)
+            munmap((void *)mData, mSize);
+        if (mFd >= 0)
+            ::close(mFd);
+        mFd = -1;
+#endif
+        mData = nullptr;
+        mSize = 0;
+        mOpen = false;
+    }
+
+    bool isOpen() const { return mOpen; }
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+    const char *begin() const { return mData; }
+    const char *end() const { return mData + mSize; }
+
+private:
+    const char *mData = nullptr;
+    size_t mSize = 0;
+    bool mOpen = false;
+#ifdef _WIN32
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    HANDLE mMapping = NULL;
+#else
+    int mFd = -1;
+#endif
+};
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "ContentHash.h"
+#include "IndexedMesh.h"
+#include "MappedFile.h"
+#include "VertexQuantization.h"
+
+// Binary mesh cache. A cache file is a fixed header followed by interleaved
+// vertex data and the index buffer, both already in the layout the GPU wants,
+// so a warm load is: map the file, check the header, hand the mapped pointers
+// to glBufferData. The header records the XXH64 of the source file it was
+// built from; a cache whose hash does not match is ignored and rebuilt.
+
+const char MESH_CACHE_MAGIC[4] = {'W', 'Z', 'M', 'C'};
+const uint32_t MESH_CACHE_VERSION = 5; // 2: optimized triangle order, 3: flags + quantized layout, 4: LOD table, 5: material batches
+const uint32_t MESH_CACHE_MAX_ATTRIBUTES = 6;
+const uint32_t MESH_CACHE_MAX_LODS = 4;
+const uint32_t MESH_CACHE_PATH_LENGTH = 120;
+
+// Attribute component types, numerically equal to the matching GL enums so
+// they can be passed to glVertexAttribPointer as-is.
+enum MeshAttributeType : uint32_t
+{
+    MESH_ATTRIB_SHORT = 0x1402,          // GL_SHORT
+    MESH_ATTRIB_UNSIGNED_SHORT = 0x1403, // GL_UNSIGNED_SHORT
+    MESH_ATTRIB_FLOAT = 0x1406,          // GL_FLOAT
+    MESH_ATTRIB_HALF_FLOAT = 0x140B,     // GL_HALF_FLOAT
+};
+
+enum MeshCacheFlags : uint32_t
+{
+    // Vertices are QuantizedVertex: positions need dequantizationMatrix() of
+    // the header AABB, normals are octahedral.
+    MESH_CACHE_QUANTIZED = 1u << 0,
+};
+// Bits 8-15 of the flags are left to the importer (e.g. its post-process
+// profile), so a cache built with other import settings is rebuilt too.
+const uint32_t MESH_CACHE_IMPORTER_SHIFT = 8;
+
+struct MeshCacheAttribute
+{
+    uint32_t location;
+    uint32_t components;
+    uint32_t type;
+    uint32_t normalized;
+    uint32_t offset; // byte offset inside one vertex
+};
+
+// One material batch: its index range in every level, and the diffuse
+// texture named by the material (empty if none).
+struct MeshCacheBatch
+{
+    uint32_t material;
+    uint32_t reserved;
+    MeshRange lods[MESH_CACHE_MAX_LODS];
+    char diffuseTexture[MESH_CACHE_PATH_LENGTH];
+};
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    float aabbMin[3];
+    float aabbMax[3];
+    uint32_t vertexCount;
+    uint32_t vertexStride;
+    uint32_t indexCount;
+    uint32_t indexSize; // 2 or 4 bytes
+    uint32_t attributeCount;
+    MeshCacheAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+    uint32_t flags; // MeshCacheFlags
+    uint32_t lodCount;
+    uint32_t batchCount;
+    MeshLod lods[MESH_CACHE_MAX_LODS]; // ranges of the index buffer, finest first
+    uint64_t vertexOffset; // from the start of the file
+    uint64_t indexOffset;
+    uint64_t batchOffset; // MeshCacheBatch[batchCount]
+    uint64_t reserved;
+};
+static_assert(sizeof(MeshCacheHeader) % 16 == 0, "keep vertex data 16-byte aligned");
+
+inline const void *meshCacheVertices(const MeshCacheHeader *header)
+{
+    return (const char *)header + header->vertexOffset;
+}
+
+inline const void *meshCacheIndices(const MeshCacheHeader *header)
+{
+    return (const char *)header + header->indexOffset;
+}
+
+inline const MeshCacheBatch *meshCacheBatches(const MeshCacheHeader *header)
+{
+    return (const MeshCacheBatch *)((const char *)header + header->batchOffset);
+}
+
+inline size_t meshCacheVertexBytes(const MeshCacheHeader *header)
+{
+    return (size_t)header->vertexCount * header->vertexStride;
+}
+
+inline size_t meshCacheIndexBytes(const MeshCacheHeader *header)
+{
+    return (size_t)header->indexCount * header->indexSize;
+}
+
+inline std::string meshCachePath(const char *sourcePath)
+{
+    return std::string(sourcePath) + ".meshcache";
+}
+
+// Hashes a whole file through a read-only mapping. Returns false if the file
+// cannot be opened.
+inline bool hashFile(const char *path, uint64_t &hash)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+    hash = hashBytes64(file.data(), file.size());
+    return true;
+}
+
+// Returns the header if [data, data + size) is a complete cache image of the
+// current version built from a source with the given hash and flags, else
+// nullptr.
+inline const MeshCacheHeader *validateMeshCache(const char *data, size_t size, uint64_t sourceHash, uint32_t flags)
+{
+    if (!data || size < sizeof(MeshCacheHeader))
+        return nullptr;
+    const MeshCacheHeader *header = (const MeshCacheHeader *)data;
+    if (memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION || header->sourceHash != sourceHash)
+        return nullptr;
+    if (header->flags != flags)
+        return nullptr;
+    if (header->attributeCount > MESH_CACHE_MAX_ATTRIBUTES || (header->indexSize != 2 && header->indexSize != 4))
+        return nullptr;
+    if (header->lodCount == 0 || header->lodCount > MESH_CACHE_MAX_LODS)
+        return nullptr;
+    for (uint32_t i = 0; i < header->lodCount; i++)
+        if ((uint64_t)header->lods[i].firstIndex + header->lods[i].indexCount > header->indexCount)
+            return nullptr;
+    if (header->batchCount == 0 || header->batchOffset + (uint64_t)header->batchCount * sizeof(MeshCacheBatch) > size)
+        return nullptr;
+    for (uint32_t b = 0; b < header->batchCount; b++)
+    {
+        const MeshCacheBatch &batch = meshCacheBatches(header)[b];
+        if (batch.diffuseTexture[MESH_CACHE_PATH_LENGTH - 1] != 0)
+            return nullptr;
+        for (uint32_t i = 0; i < header->lodCount; i++)
+            if ((uint64_t)batch.lods[i].firstIndex + batch.lods[i].indexCount > header->indexCount)
+                return nullptr;
+    }
+    if (header->vertexOffset + meshCacheVertexBytes(header) > size || header->indexOffset + meshCacheIndexBytes(header) > size)
+        return nullptr;
+    return header;
+}
+
+// Serializes mesh into a cache image, using 16-bit indices when they fit.
+// flags selects the vertex layout (MESH_CACHE_QUANTIZED or full floats).
+// Levels past MESH_CACHE_MAX_LODS are dropped, and texture paths that do not
+// fit MESH_CACHE_PATH_LENGTH are left empty.
+inline void buildMeshCache(const IndexedMesh &mesh, uint64_t sourceHash, uint32_t flags, std::vector<char> &image)
+{
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+    header.version = MESH_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.flags = flags;
+
+    glm::vec3 lo, hi;
+    computeBounds(mesh, lo, hi);
+    memcpy(header.aabbMin, &lo, sizeof(header.aabbMin));
+    memcpy(header.aabbMax, &hi, sizeof(header.aabbMax));
+
+    std::vector<QuantizedVertex> quantized;
+    const void *vertexData = mesh.vertices.data();
+    header.vertexCount = (uint32_t)mesh.vertices.size();
+    header.indexCount = (uint32_t)mesh.indices.size();
+    header.indexSize = mesh.fitsShortIndices() ? 2 : 4;
+    header.attributeCount = 3;
+    if (mesh.lods.empty())
+    {
+        header.lodCount = 1;
+        header.lods[0] = {0, header.indexCount, 0.0f};
+    }
+    else
+    {
+        header.lodCount = (uint32_t)std::min<size_t>(mesh.lods.size(), MESH_CACHE_MAX_LODS);
+        memcpy(header.lods, mesh.lods.data(), header.lodCount * sizeof(MeshLod));
+    }
+    if (flags & MESH_CACHE_QUANTIZED)
+    {
+        quantizeVertices(mesh.vertices, lo, hi, quantized);
+        vertexData = quantized.data();
+        header.vertexStride = sizeof(QuantizedVertex);
+        header.attributes[0] = {0, 3, MESH_ATTRIB_UNSIGNED_SHORT, 1, (uint32_t)offsetof(QuantizedVertex, position)};
+        header.attributes[1] = {1, 2, MESH_ATTRIB_SHORT, 1, (uint32_t)offsetof(QuantizedVertex, normal)};
+        header.attributes[2] = {2, 2, MESH_ATTRIB_HALF_FLOAT, 0, (uint32_t)offsetof(QuantizedVertex, uv)};
+    }
+    else
+    {
+        header.vertexStride = sizeof(MeshVertex);
+        header.attributes[0] = {0, 3, MESH_ATTRIB_FLOAT, 0, (uint32_t)offsetof(MeshVertex, position)};
+        header.attributes[1] = {1, 3, MESH_ATTRIB_FLOAT, 0, (uint32_t)offsetof(MeshVertex, normal)};
+        header.attributes[2] = {2, 2, MESH_ATTRIB_FLOAT, 0, (uint32_t)offsetof(MeshVertex, uv)};
+    }
+    std::vector<MeshCacheBatch> batches(std::max<size_t>(mesh.batches.size(), 1));
+    memset(batches.data(), 0, batches.size() * sizeof(MeshCacheBatch));
+    for (size_t b = 0; b < mesh.batches.size(); b++)
+    {
+        const MeshBatch &source = mesh.batches[b];
+        batches[b].material = source.material;
+        for (uint32_t i = 0; i < header.lodCount && i < source.lods.size(); i++)
+            batches[b].lods[i] = source.lods[i];
+        if (source.diffuseTexture.size() < MESH_CACHE_PATH_LENGTH)
+            memcpy(batches[b].diffuseTexture, source.diffuseTexture.c_str(), source.diffuseTexture.size());
+    }
+    if (mesh.batches.empty())
+    {
+        for (uint32_t i = 0; i < header.lodCount; i++)
+            batches[0].lods[i] = {header.lods[i].firstIndex, header.lods[i].indexCount};
+    }
+    header.batchCount = (uint32_t)batches.size();
+
+    header.vertexOffset = sizeof(MeshCacheHeader);
+    header.indexOffset = header.vertexOffset + meshCacheVertexBytes(&header);
+    header.batchOffset = (header.indexOffset + meshCacheIndexBytes(&header) + 7) & ~(uint64_t)7;
+
+    image.assign(header.batchOffset + batches.size() * sizeof(MeshCacheBatch), 0);
+    memcpy(image.data() + header.batchOffset, batches.data(), batches.size() * sizeof(MeshCacheBatch));
+    memcpy(image.data(), &header, sizeof(header));
+    memcpy(image.data() + header.vertexOffset, vertexData, meshCacheVertexBytes(&header));
+    char *indices = image.data() + header.indexOffset;
+    if (header.indexSize == 2)
+    {
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+        {
+            uint16_t index = (uint16_t)mesh.indices[i];
+            memcpy(indices + i * 2, &index, 2);
+        }
+    }
+    else
+    {
+        memcpy(indices, mesh.indices.data(), meshCacheIndexBytes(&header));
+    }
+}
+
+// Writes image to path through a temporary file, so a crash mid-write never
+// leaves a truncated cache that later passes validation.
+inline bool writeCacheFile(const char *path, const std::vector<char> &image)
+{
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+    ok = (fclose(file) == 0) && ok;
+    if (ok)
+    {
+        remove(path); // rename() does not replace existing files on Windows
+        ok = rename(tmpPath.c_str(), path) == 0;
+    }
+    if (!ok)
+        remove(tmpPath.c_str());
+    return ok;
+}
+
+// A cache file mapped for reading. header is null unless the file is a valid
+// cache for the given source hash and flags.
+struct MeshCacheFile
+{
+    MappedFile file;
+    const MeshCacheHeader *header = nullptr;
+
+    bool open(const char *path, uint64_t sourceHash, uint32_t flags)
+    {
+        header = nullptr;
+        if (!file.open(path))
+            return false;
+        header = validateMeshCache(file.data(), file.size(), sourceHash, flags);
+        if (!header)
+            file.close();
+        return header != nullptr;
+    }
+};
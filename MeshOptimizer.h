@@ -0,0 +1,323 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+#include "IndexedMesh.h"
+
+// Import-time triangle/vertex reordering for indexed meshes:
+//  - optimizeVertexCache: Tipsify (Sander, Nehab, Barczak 2007), reorders
+//    triangles so recently transformed vertices are reused from the GPU's
+//    post-transform cache;
+//  - optimizeOverdraw: splits that order into clusters and sorts them so
+//    outward-facing parts draw first, which helps early-Z;
+//  - optimizeVertexFetch: renumbers vertices in first-use order so vertex
+//    fetches walk the VBO linearly.
+// analyzeVertexCache measures the result with a FIFO cache model.
+
+struct VertexCacheStats
+{
+    float acmr; // average cache miss ratio: transformed vertices per triangle (0.5 .. 3)
+    float atvr; // average transform to vertex ratio: transformed vertices per unique vertex (1 ideal)
+};
+
+const unsigned DEFAULT_VERTEX_CACHE_SIZE = 16;
+
+// Simulates a FIFO post-transform cache of cacheSize entries.
+inline VertexCacheStats analyzeVertexCache(const std::vector<uint32_t> &indices, size_t vertexCount, unsigned cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+{
+    std::vector<unsigned> timestamps(vertexCount, 0);
+    unsigned time = cacheSize + 1;
+    size_t misses = 0;
+    for (uint32_t v : indices)
+    {
+        if (time - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = time++;
+            misses++;
+        }
+    }
+    VertexCacheStats stats;
+    size_t triangles = indices.size() / 3;
+    stats.acmr = triangles ? (float)misses / triangles : 0.0f;
+    stats.atvr = vertexCount ? (float)misses / vertexCount : 0.0f;
+    return stats;
+}
+
+namespace meshopt_detail
+{
+    // Vertex -> triangle adjacency in CSR form.
+    struct TriangleAdjacency
+    {
+        std::vector<uint32_t> offsets; // vertexCount + 1
+        std::vector<uint32_t> triangles;
+
+        TriangleAdjacency(const std::vector<uint32_t> &indices, size_t vertexCount)
+            : offsets(vertexCount + 1, 0), triangles(indices.size())
+        {
+            for (uint32_t v : indices)
+                offsets[v + 1]++;
+            for (size_t v = 0; v < vertexCount; v++)
+                offsets[v + 1] += offsets[v];
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++)
+                triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+        }
+    };
+}
+
+// Tipsify: fans around a focus vertex, emitting all its remaining triangles,
+// then moves to the candidate vertex that is most likely still in the cache.
+inline void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount, unsigned cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+        return;
+
+    meshopt_detail::TriangleAdjacency adjacency(indices, vertexCount);
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+
+    std::vector<unsigned> cacheTime(vertexCount, 0);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    deadEnd.reserve(indices.size());
+
+    unsigned time = cacheSize + 1;
+    size_t cursor = 0;
+    int64_t focus = 0;
+
+    while (focus >= 0)
+    {
+        candidates.clear();
+        const uint32_t f = (uint32_t)focus;
+        for (uint32_t k = adjacency.offsets[f]; k < adjacency.offsets[f + 1]; k++)
+        {
+            uint32_t t = adjacency.triangles[k];
+            if (emitted[t])
+                continue;
+            emitted[t] = 1;
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t v = indices[t * 3 + c];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+
+        // Next focus: the live candidate that stays in cache longest after
+        // fanning around it; fall back to the dead-end stack, then a scan.
+        focus = -1;
+        int best = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveTriangles[v] == 0)
+                continue;
+            int priority = 0;
+            if ((int)(time - cacheTime[v]) + 2 * (int)liveTriangles[v] <= (int)cacheSize)
+                priority = (int)(time - cacheTime[v]);
+            if (priority > best)
+            {
+                best = priority;
+                focus = v;
+            }
+        }
+        if (focus < 0)
+        {
+            while (!deadEnd.empty())
+            {
+                uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[v] > 0)
+                {
+                    focus = v;
+                    break;
+                }
+            }
+        }
+        if (focus < 0)
+        {
+            while (cursor < vertexCount && liveTriangles[cursor] == 0)
+                cursor++;
+            if (cursor < vertexCount)
+                focus = (int64_t)cursor;
+        }
+    }
+    indices.swap(result);
+}
+
+// Overdraw reduction on top of a cache-optimized order (the "fast linear"
+// clustering from the Tipsify paper). The order is cut where the cache
+// restarts anyway (a triangle with three misses), and each piece is cut again
+// wherever its running ACMR is within threshold of the piece's overall ACMR,
+// so the split costs at most that much cache efficiency. Clusters are then
+// sorted by how much they face away from the mesh centroid: outer shells
+// draw first and occlude what is behind them.
+inline void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<MeshVertex> &vertices, float threshold = 1.05f, unsigned cacheSize = DEFAULT_VERTEX_CACHE_SIZE)
+{
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // Hard boundaries: positions where a FIFO cache misses all three corners.
+    std::vector<size_t> hard;
+    {
+        std::vector<unsigned> timestamps(vertices.size(), 0);
+        unsigned time = cacheSize + 1;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            int misses = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t v = indices[t * 3 + c];
+                if (time - timestamps[v] > cacheSize)
+                {
+                    timestamps[v] = time++;
+                    misses++;
+                }
+            }
+            if (t == 0 || misses == 3)
+                hard.push_back(t);
+        }
+        hard.push_back(triangleCount);
+    }
+
+    // Soft boundaries inside each hard cluster.
+    std::vector<size_t> clusters;
+    std::vector<unsigned> timestamps(vertices.size(), 0);
+    unsigned time = cacheSize + 1;
+    for (size_t h = 0; h + 1 < hard.size(); h++)
+    {
+        const size_t start = hard[h], end = hard[h + 1];
+        std::vector<uint32_t> piece(indices.begin() + start * 3, indices.begin() + end * 3);
+        const float pieceAcmr = analyzeVertexCache(piece, vertices.size(), cacheSize).acmr;
+
+        clusters.push_back(start);
+        time += cacheSize + 1; // flush
+        size_t misses = 0, count = 0;
+        for (size_t t = start; t < end; t++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t v = indices[t * 3 + c];
+                if (time - timestamps[v] > cacheSize)
+                {
+                    timestamps[v] = time++;
+                    misses++;
+                }
+            }
+            count++;
+            if (t + 1 < end && (float)misses / count <= pieceAcmr * threshold && count >= 8)
+            {
+                clusters.push_back(t + 1);
+                time += cacheSize + 1;
+                misses = count = 0;
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    // Area-weighted mesh centroid.
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const glm::vec3 &a = vertices[indices[t * 3]].position;
+        const glm::vec3 &b = vertices[indices[t * 3 + 1]].position;
+        const glm::vec3 &c = vertices[indices[t * 3 + 2]].position;
+        float area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += (a + b + c) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    struct Cluster
+    {
+        size_t start, end;
+        float sortKey;
+    };
+    std::vector<Cluster> sorted;
+    sorted.reserve(clusters.size());
+    for (size_t k = 0; k + 1 < clusters.size(); k++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[k]; t < clusters[k + 1]; t++)
+        {
+            const glm::vec3 &a = vertices[indices[t * 3]].position;
+            const glm::vec3 &b = vertices[indices[t * 3 + 1]].position;
+            const glm::vec3 &c = vertices[indices[t * 3 + 2]].position;
+            glm::vec3 n = glm::cross(b - a, c - a); // length = 2 * area
+            float a2 = glm::length(n);
+            centroid += (a + b + c) * (a2 / 3.0f);
+            normal += n;
+            area += a2;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float len = glm::length(normal);
+        float key = len > 0.0f ? glm::dot(centroid - meshCentroid, normal / len) : 0.0f;
+        sorted.push_back({clusters[k], clusters[k + 1], key});
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b)
+                     { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (const Cluster &c : sorted)
+        result.insert(result.end(), indices.begin() + c.start * 3, indices.begin() + c.end * 3);
+    indices.swap(result);
+}
+
+// Renumbers vertices in the order the index buffer first references them and
+// drops vertices no triangle uses.
+inline void optimizeVertexFetch(IndexedMesh &mesh)
+{
+    const uint32_t Unused = 0xFFFFFFFFu;
+    std::vector<uint32_t> remap(mesh.vertices.size(), Unused);
+    std::vector<MeshVertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    for (uint32_t &index : mesh.indices)
+    {
+        if (remap[index] == Unused)
+        {
+            remap[index] = (uint32_t)vertices.size();
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+}
+
+// Full pass used by the importers: cache order, optional overdraw clustering,
+// then fetch order. Each batch is reordered within its own (level 0) range so
+// it stays drawable with one call.
+inline void optimizeMesh(IndexedMesh &mesh, bool reduceOverdraw = true)
+{
+    std::vector<MeshRange> ranges;
+    for (const MeshBatch &batch : mesh.batches)
+        ranges.push_back(batch.lods[0]);
+    if (ranges.empty())
+        ranges.push_back({0, (uint32_t)mesh.indices.size()});
+
+    for (const MeshRange &range : ranges)
+    {
+        std::vector<uint32_t> part(mesh.indices.begin() + range.firstIndex, mesh.indices.begin() + range.firstIndex + range.indexCount);
+        optimizeVertexCache(part, mesh.vertices.size());
+        if (reduceOverdraw)
+            optimizeOverdraw(part, mesh.vertices);
+        std::copy(part.begin(), part.end(), mesh.indices.begin() + range.firstIndex);
+    }
+    optimizeVertexFetch(mesh);
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <math.h>
+#include <queue>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "IndexedMesh.h"
+#include "MeshOptimizer.h"
+
+// Quadric error metric simplification (Garland & Heckbert) by half-edge
+// collapse: a vertex is merged into one of its neighbours, so the simplified
+// index buffer keeps referencing the original vertex array and every LOD can
+// share one VBO.
+//
+// Vertices are grouped by position first. A position that is on an open
+// border, or that has several vertices (a uv/normal seam), is locked: it is
+// never removed, which keeps silhouettes of open meshes and texture seams
+// intact. Unlocked positions collapse only into neighbours with a single
+// vertex, so no attribute has to be invented or averaged.
+
+namespace simplify_detail
+{
+    struct Quadric
+    {
+        // Symmetric 4x4 matrix, upper triangle: a2 ab ac ad b2 bc bd c2 cd d2
+        double q[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        static Quadric fromPlane(double a, double b, double c, double d)
+        {
+            Quadric r;
+            r.q[0] = a * a; r.q[1] = a * b; r.q[2] = a * c; r.q[3] = a * d;
+            r.q[4] = b * b; r.q[5] = b * c; r.q[6] = b * d;
+            r.q[7] = c * c; r.q[8] = c * d;
+            r.q[9] = d * d;
+            return r;
+        }
+
+        void add(const Quadric &o)
+        {
+            for (int i = 0; i < 10; i++)
+                q[i] += o.q[i];
+        }
+
+        // Sum of squared distances from p to the accumulated planes.
+        double error(const glm::vec3 &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double e = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                     + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                     + q[7] * z * z + 2 * q[8] * z
+                     + q[9];
+            return e > 0.0 ? e : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        double cost;
+        uint32_t from, to;     // position ids
+        uint32_t fromVersion, toVersion;
+        bool operator<(const Collapse &o) const { return cost > o.cost; } // min-heap
+    };
+
+    inline glm::vec3 triangleNormal(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+    {
+        return glm::cross(b - a, c - a);
+    }
+}
+
+// Simplifies the triangle list indices (into vertices) until it has at most
+// targetIndexCount indices or the next collapse would exceed maxError.
+// Returns the geometric error reached: an upper bound on how far, in mesh
+// units, the simplified surface moved from the input.
+inline float simplifyMesh(const std::vector<MeshVertex> &vertices, const std::vector<uint32_t> &indices,
+                          size_t targetIndexCount, std::vector<uint32_t> &out, float maxError = 1e30f)
+{
+    using namespace simplify_detail;
+    const uint32_t None = 0xFFFFFFFFu;
+
+    // Group vertices by position.
+    VertexWelder<glm::vec3> positionWelder(vertices.size());
+    std::vector<uint32_t> positionOf(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+        positionOf[i] = positionWelder.insert(vertices[i].position);
+    const std::vector<glm::vec3> &positions = positionWelder.keys();
+    const size_t positionCount = positions.size();
+
+    // wedge: the single vertex at a position, or None on a seam.
+    std::vector<uint32_t> wedge(positionCount, None);
+    std::vector<uint32_t> wedgeCount(positionCount, 0);
+    std::vector<char> locked(positionCount, 0);
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        uint32_t p = positionOf[i];
+        wedge[p] = wedgeCount[p]++ == 0 ? (uint32_t)i : None;
+        if (wedgeCount[p] > 1)
+            locked[p] = 1;
+    }
+
+    std::vector<uint32_t> tris(indices);
+    const size_t triangleCount = tris.size() / 3;
+    std::vector<char> triAlive(triangleCount, 1);
+    std::vector<std::vector<uint32_t>> positionTris(positionCount);
+    std::vector<Quadric> quadrics(positionCount);
+
+    // Open borders: position edges used by exactly one triangle.
+    {
+        std::vector<std::pair<uint64_t, int>> edges;
+        edges.reserve(tris.size());
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t a = positionOf[tris[t * 3 + c]], b = positionOf[tris[t * 3 + (c + 1) % 3]];
+                if (a > b)
+                    std::swap(a, b);
+                edges.push_back({((uint64_t)a << 32) | b, 1});
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size();)
+        {
+            size_t j = i;
+            while (j < edges.size() && edges[j].first == edges[i].first)
+                j++;
+            if (j - i == 1)
+            {
+                locked[(uint32_t)(edges[i].first >> 32)] = 1;
+                locked[(uint32_t)(edges[i].first & 0xFFFFFFFFu)] = 1;
+            }
+            i = j;
+        }
+    }
+
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const glm::vec3 &a = vertices[tris[t * 3]].position;
+        const glm::vec3 &b = vertices[tris[t * 3 + 1]].position;
+        const glm::vec3 &c = vertices[tris[t * 3 + 2]].position;
+        glm::vec3 n = triangleNormal(a, b, c);
+        float len = glm::length(n);
+        if (len > 0.0f)
+            n /= len;
+        Quadric plane = Quadric::fromPlane(n.x, n.y, n.z, -glm::dot(n, a));
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t p = positionOf[tris[t * 3 + k]];
+            quadrics[p].add(plane);
+            positionTris[p].push_back((uint32_t)t);
+        }
+    }
+
+    std::vector<uint32_t> version(positionCount, 0);
+    std::vector<char> positionAlive(positionCount, 1);
+    std::priority_queue<Collapse> queue;
+
+    auto collapseCost = [&](uint32_t from, uint32_t to)
+    {
+        Quadric q = quadrics[from];
+        q.add(quadrics[to]);
+        return q.error(positions[to]);
+    };
+    auto pushCollapse = [&](uint32_t from, uint32_t to)
+    {
+        if (locked[from] || wedge[to] == None)
+            return;
+        queue.push({collapseCost(from, to), from, to, version[from], version[to]});
+    };
+    auto neighbours = [&](uint32_t p, std::vector<uint32_t> &result)
+    {
+        result.clear();
+        for (uint32_t t : positionTris[p])
+        {
+            if (!triAlive[t])
+                continue;
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t q = positionOf[tris[t * 3 + c]];
+                if (q != p)
+                    result.push_back(q);
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    };
+
+    std::vector<uint32_t> ring, ringTo;
+    for (uint32_t p = 0; p < positionCount; p++)
+    {
+        neighbours(p, ring);
+        for (uint32_t q : ring)
+            pushCollapse(p, q);
+    }
+
+    size_t aliveTriangles = triangleCount;
+    double reachedCost = 0.0;
+    const double maxCost = (double)maxError * maxError;
+
+    while (aliveTriangles * 3 > targetIndexCount && !queue.empty())
+    {
+        Collapse c = queue.top();
+        queue.pop();
+        if (!positionAlive[c.from] || !positionAlive[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion)
+            continue;
+        if (c.cost > maxCost)
+            break;
+
+        // Link condition: the two rings may only share the vertices opposite
+        // the collapsed edge, otherwise the collapse pinches the surface.
+        neighbours(c.from, ring);
+        neighbours(c.to, ringTo);
+        size_t shared = 0, sharedTris = 0;
+        for (uint32_t q : ring)
+            shared += std::binary_search(ringTo.begin(), ringTo.end(), q) ? 1 : 0;
+        for (uint32_t t : positionTris[c.from])
+        {
+            if (!triAlive[t])
+                continue;
+            for (int k = 0; k < 3; k++)
+                sharedTris += positionOf[tris[t * 3 + k]] == c.to ? 1 : 0;
+        }
+        if (shared > sharedTris)
+            continue;
+
+        // Reject collapses that flip or crush a remaining triangle.
+        bool flips = false;
+        for (uint32_t t : positionTris[c.from])
+        {
+            if (!triAlive[t])
+                continue;
+            glm::vec3 p[3];
+            bool hasTo = false;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t q = positionOf[tris[t * 3 + k]];
+                hasTo = hasTo || q == c.to;
+                p[k] = positions[q];
+            }
+            if (hasTo)
+                continue;
+            glm::vec3 before = triangleNormal(p[0], p[1], p[2]);
+            for (int k = 0; k < 3; k++)
+                if (positionOf[tris[t * 3 + k]] == c.from)
+                    p[k] = positions[c.to];
+            glm::vec3 after = triangleNormal(p[0], p[1], p[2]);
+            if (glm::dot(before, after) <= 0.2f * glm::length(before) * glm::length(after))
+            {
+                flips = true;
+                break;
+            }
+        }
+        if (flips)
+            continue;
+
+        // Collapse: triangles on the edge disappear, the rest move to c.to.
+        const uint32_t toVertex = wedge[c.to];
+        for (uint32_t t : positionTris[c.from])
+        {
+            if (!triAlive[t])
+                continue;
+            bool hasTo = false;
+            for (int k = 0; k < 3; k++)
+                hasTo = hasTo || positionOf[tris[t * 3 + k]] == c.to;
+            if (hasTo)
+            {
+                triAlive[t] = 0;
+                aliveTriangles--;
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+                if (positionOf[tris[t * 3 + k]] == c.from)
+                    tris[t * 3 + k] = toVertex;
+            positionTris[c.to].push_back(t);
+        }
+        positionAlive[c.from] = 0;
+        positionTris[c.from].clear();
+        quadrics[c.to].add(quadrics[c.from]);
+        version[c.to]++;
+        reachedCost = std::max(reachedCost, c.cost);
+
+        neighbours(c.to, ringTo);
+        for (uint32_t q : ringTo)
+        {
+            pushCollapse(q, c.to);
+            pushCollapse(c.to, q);
+        }
+    }
+
+    out.clear();
+    out.reserve(aliveTriangles * 3);
+    for (size_t t = 0; t < triangleCount; t++)
+        if (triAlive[t])
+            out.insert(out.end(), tris.begin() + t * 3, tris.begin() + t * 3 + 3);
+    return (float)sqrt(reachedCost);
+}
+
+// Builds up to levelCount levels of detail. Level 0 is the existing index
+// buffer; each further level targets half the triangles of the previous one
+// and is simplified from it, so the errors accumulate. Batches are simplified
+// separately (their shared edges are open borders and stay locked, so
+// materials do not crack apart); a batch that stops shrinking repeats its
+// last level. The index buffer is rebuilt level-major: every level holds all
+// batches back to back, and mesh.lods / batch.lods describe the ranges.
+inline void buildLodChain(IndexedMesh &mesh, unsigned levelCount = 4)
+{
+    if (mesh.batches.empty())
+        mesh.batches.push_back({0, std::string(), {{0, (uint32_t)mesh.indices.size()}}});
+
+    std::vector<std::vector<std::vector<uint32_t>>> levels(mesh.batches.size());
+    std::vector<std::vector<float>> errors(mesh.batches.size());
+    size_t lodCount = 1;
+    for (size_t b = 0; b < mesh.batches.size(); b++)
+    {
+        const MeshRange &base = mesh.batches[b].lods[0];
+        levels[b].emplace_back(mesh.indices.begin() + base.firstIndex, mesh.indices.begin() + base.firstIndex + base.indexCount);
+        errors[b].push_back(0.0f);
+        for (unsigned level = 1; level < levelCount; level++)
+        {
+            const std::vector<uint32_t> &previous = levels[b].back();
+            std::vector<uint32_t> simplified;
+            size_t target = (previous.size() / 3 / 2) * 3;
+            float error = errors[b].back() + simplifyMesh(mesh.vertices, previous, target, simplified);
+            if (simplified.size() >= previous.size() * 9 / 10 || simplified.empty())
+                break;
+            optimizeVertexCache(simplified, mesh.vertices.size());
+            levels[b].push_back(std::move(simplified));
+            errors[b].push_back(error);
+        }
+        lodCount = std::max(lodCount, levels[b].size());
+    }
+
+    mesh.indices.clear();
+    mesh.lods.clear();
+    for (MeshBatch &batch : mesh.batches)
+        batch.lods.clear();
+    for (size_t level = 0; level < lodCount; level++)
+    {
+        MeshLod lod = {(uint32_t)mesh.indices.size(), 0, 0.0f};
+        for (size_t b = 0; b < mesh.batches.size(); b++)
+        {
+            size_t l = std::min(level, levels[b].size() - 1);
+            const std::vector<uint32_t> &src = levels[b][l];
+            mesh.batches[b].lods.push_back({(uint32_t)mesh.indices.size(), (uint32_t)src.size()});
+            mesh.indices.insert(mesh.indices.end(), src.begin(), src.end());
+            lod.error = std::max(lod.error, errors[b][l]);
+        }
+        lod.indexCount = (uint32_t)mesh.indices.size() - lod.firstIndex;
+        mesh.lods.push_back(lod);
+    }
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_CHAIN_SSE2 1
+#endif
+
+// CPU mip chain generation for RGBA8 textures. Colour is filtered in linear
+// light (sRGB decoded through a table, re-encoded on output) so dark and
+// bright detail keep their weight in the smaller levels; alpha is filtered
+// as-is. Levels are built from the float result of the previous level, not
+// from a requantized copy. Pixels are addressed with wrap-around, matching
+// the GL_REPEAT sampling every texture here uses. A pixel's four channels sit
+// in one SSE register, so every filter tap is one multiply-add.
+
+enum MipFilter : uint32_t
+{
+    MIP_FILTER_BOX = 0,    // 2x2 average, like glGenerateMipmap
+    MIP_FILTER_KAISER = 1, // Kaiser-windowed sinc over 8 taps: sharper, less aliasing
+};
+
+namespace mip_chain_detail
+{
+    struct Pixel
+    {
+        float c[4];
+    };
+
+    inline const float *srgbToLinearTable()
+    {
+        static const std::vector<float> table = []
+        {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; i++)
+            {
+                float v = i / 255.0f;
+                t[i] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    // Linear [0,1] in 1/8191 steps to 8-bit sRGB, fine enough near black
+    // where one sRGB step is 1/3295 in linear.
+    const int LINEAR_TABLE_SIZE = 8192;
+
+    inline const uint8_t *linearToSrgbTable()
+    {
+        static const std::vector<uint8_t> table = []
+        {
+            std::vector<uint8_t> t(LINEAR_TABLE_SIZE);
+            for (int i = 0; i < LINEAR_TABLE_SIZE; i++)
+            {
+                float v = (float)i / (LINEAR_TABLE_SIZE - 1);
+                float s = v <= 0.0031308f ? v * 12.92f : 1.055f * powf(v, 1.0f / 2.4f) - 0.055f;
+                t[i] = (uint8_t)std::min(255.0f, s * 255.0f + 0.5f);
+            }
+            return t;
+        }();
+        return table.data();
+    }
+
+    inline void toLinear(const uint8_t *rgba, size_t count, std::vector<Pixel> &out)
+    {
+        const float *table = srgbToLinearTable();
+        out.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint8_t *p = rgba + i * 4;
+            out[i] = {{table[p[0]], table[p[1]], table[p[2]], p[3] / 255.0f}};
+        }
+    }
+
+    inline void toSrgb(const std::vector<Pixel> &pixels, std::vector<uint8_t> &out)
+    {
+        const uint8_t *table = linearToSrgbTable();
+        out.resize(pixels.size() * 4);
+#ifdef MIP_CHAIN_SSE2
+        const __m128 scale = _mm_setr_ps(LINEAR_TABLE_SIZE - 1, LINEAR_TABLE_SIZE - 1, LINEAR_TABLE_SIZE - 1, 255.0f);
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pixels[i].c), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+            alignas(16) int32_t q[4];
+            _mm_store_si128((__m128i *)q, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), _mm_set1_ps(0.5f))));
+            uint8_t *o = &out[i * 4];
+            o[0] = table[q[0]];
+            o[1] = table[q[1]];
+            o[2] = table[q[2]];
+            o[3] = (uint8_t)q[3];
+        }
+#else
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            uint8_t *q = &out[i * 4];
+            for (int c = 0; c < 3; c++)
+                q[c] = table[(int)(std::min(std::max(pixels[i].c[c], 0.0f), 1.0f) * (LINEAR_TABLE_SIZE - 1) + 0.5f)];
+            q[3] = (uint8_t)(std::min(std::max(pixels[i].c[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+#endif
+    }
+
+    inline Pixel average4(const Pixel &a, const Pixel &b, const Pixel &c, const Pixel &d)
+    {
+        Pixel result;
+#ifdef MIP_CHAIN_SSE2
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a.c), _mm_loadu_ps(b.c)), _mm_add_ps(_mm_loadu_ps(c.c), _mm_loadu_ps(d.c)));
+        _mm_storeu_ps(result.c, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+        for (int i = 0; i < 4; i++)
+            result.c[i] = (a.c[i] + b.c[i] + c.c[i] + d.c[i]) * 0.25f;
+#endif
+        return result;
+    }
+
+    // out = sum of weight[k] * in[k]
+    inline Pixel weightedSum(const Pixel *const *in, const float *weights, int count)
+    {
+        Pixel result;
+#ifdef MIP_CHAIN_SSE2
+        __m128 acc = _mm_setzero_ps();
+        for (int k = 0; k < count; k++)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(in[k]->c), _mm_set1_ps(weights[k])));
+        _mm_storeu_ps(result.c, acc);
+#else
+        for (int c = 0; c < 4; c++)
+        {
+            float acc = 0.0f;
+            for (int k = 0; k < count; k++)
+                acc += in[k]->c[c] * weights[k];
+            result.c[c] = acc;
+        }
+#endif
+        return result;
+    }
+
+    inline float besselI0(float x)
+    {
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 16; k++)
+        {
+            term *= (x / (2.0f * k)) * (x / (2.0f * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    inline uint32_t wrap(int i, uint32_t size)
+    {
+        int m = i % (int)size;
+        return (uint32_t)(m < 0 ? m + (int)size : m);
+    }
+
+    // Taps that take one axis from inSize to outSize pixels: output i reads
+    // input index[i * taps + k] (already wrapped) with weights[i * taps + k].
+    struct Resampler
+    {
+        int taps = 0;
+        std::vector<uint32_t> index;
+        std::vector<float> weights;
+    };
+
+    inline void buildResampler(uint32_t inSize, uint32_t outSize, MipFilter filter, Resampler &r)
+    {
+        const float scale = (float)inSize / outSize;
+        const float width = std::max(scale, 1.0f); // magnifying keeps the kernel one input pixel wide
+        if (inSize == outSize)
+        {
+            // axis kept as is (a 1-pixel side of a mip level, or a resize
+            // changing only the other axis)
+            r.taps = 1;
+            r.weights.assign(outSize, 1.0f);
+            r.index.resize(outSize);
+            for (uint32_t i = 0; i < outSize; i++)
+                r.index[i] = i;
+            return;
+        }
+        if (filter == MIP_FILTER_BOX)
+        {
+            r.taps = 2;
+            r.weights.assign((size_t)outSize * r.taps, 1.0f / r.taps);
+            r.index.resize((size_t)outSize * r.taps);
+            for (uint32_t i = 0; i < outSize; i++)
+                for (int k = 0; k < r.taps; k++)
+                    r.index[(size_t)i * r.taps + k] = std::min(i * 2 + k, inSize - 1);
+            return;
+        }
+        const float radius = 2.0f, alpha = 4.0f; // in output pixels
+        const float pi = 3.14159265f;
+        const float norm = besselI0(alpha);
+        r.taps = (int)ceilf(2.0f * radius * width) + 1;
+        r.weights.resize((size_t)outSize * r.taps);
+        r.index.resize((size_t)outSize * r.taps);
+        for (uint32_t i = 0; i < outSize; i++)
+        {
+            float center = (i + 0.5f) * scale;
+            int first = (int)floorf(center - radius * width + 0.5f);
+            float *w = &r.weights[(size_t)i * r.taps];
+            float total = 0.0f;
+            for (int k = 0; k < r.taps; k++)
+            {
+                r.index[(size_t)i * r.taps + k] = wrap(first + k, inSize);
+                float t = (first + k + 0.5f - center) / width;
+                float window = fabsf(t) < radius ? besselI0(alpha * sqrtf(1.0f - (t / radius) * (t / radius))) / norm : 0.0f;
+                float sinc = fabsf(t) < 1e-5f ? 1.0f : sinf(pi * t) / (pi * t);
+                w[k] = sinc * window;
+                total += w[k];
+            }
+            for (int k = 0; k < r.taps; k++)
+                w[k] /= total;
+        }
+    }
+
+    // Resizes with the windowed sinc: a horizontal then a vertical pass.
+    inline void resample(const std::vector<Pixel> &in, uint32_t width, uint32_t height, uint32_t outWidth, uint32_t outHeight,
+                         std::vector<Pixel> &out)
+    {
+        Resampler rx, ry;
+        buildResampler(width, outWidth, MIP_FILTER_KAISER, rx);
+        buildResampler(height, outHeight, MIP_FILTER_KAISER, ry);
+
+        std::vector<Pixel> rows((size_t)outWidth * height);
+        std::vector<const Pixel *> taps(std::max(rx.taps, ry.taps));
+        for (uint32_t y = 0; y < height; y++)
+        {
+            const Pixel *row = &in[(size_t)y * width];
+            for (uint32_t x = 0; x < outWidth; x++)
+            {
+                for (int k = 0; k < rx.taps; k++)
+                    taps[k] = &row[rx.index[(size_t)x * rx.taps + k]];
+                rows[(size_t)y * outWidth + x] = weightedSum(taps.data(), &rx.weights[(size_t)x * rx.taps], rx.taps);
+            }
+        }
+
+        out.resize((size_t)outWidth * outHeight);
+        for (uint32_t y = 0; y < outHeight; y++)
+            for (uint32_t x = 0; x < outWidth; x++)
+            {
+                for (int k = 0; k < ry.taps; k++)
+                    taps[k] = &rows[(size_t)ry.index[(size_t)y * ry.taps + k] * outWidth + x];
+                out[(size_t)y * outWidth + x] = weightedSum(taps.data(), &ry.weights[(size_t)y * ry.taps], ry.taps);
+            }
+    }
+
+    // One level down: a single 2x2 pass for the box filter (the last row or
+    // column is dropped at odd sizes, as glGenerateMipmap does), otherwise a
+    // windowed-sinc resample.
+    inline void downsample(const std::vector<Pixel> &in, uint32_t width, uint32_t height, MipFilter filter, std::vector<Pixel> &out)
+    {
+        uint32_t outWidth = std::max(1u, width / 2), outHeight = std::max(1u, height / 2);
+        if (filter == MIP_FILTER_BOX)
+        {
+            out.resize((size_t)outWidth * outHeight);
+            for (uint32_t y = 0; y < outHeight; y++)
+            {
+                const Pixel *row0 = &in[(size_t)std::min(2 * y, height - 1) * width];
+                const Pixel *row1 = &in[(size_t)std::min(2 * y + 1, height - 1) * width];
+                Pixel *dst = &out[(size_t)y * outWidth];
+                for (uint32_t x = 0; x < outWidth; x++)
+                {
+                    uint32_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                    dst[x] = average4(row0[x0], row0[x1], row1[x0], row1[x1]);
+                }
+            }
+            return;
+        }
+        resample(in, width, height, outWidth, outHeight, out);
+    }
+} // namespace mip_chain_detail
+
+// Builds levels 1..levelCount-1 of an RGBA8 image; levels[i] holds level
+// i + 1, each half the size of the one before (rounded down, at least 1).
+inline void generateMipChain(const uint8_t *rgba, uint32_t width, uint32_t height, MipFilter filter, uint32_t levelCount,
+                             std::vector<std::vector<uint8_t>> &levels)
+{
+    using namespace mip_chain_detail;
+    levels.assign(levelCount > 1 ? levelCount - 1 : 0, std::vector<uint8_t>());
+    std::vector<Pixel> current, next;
+    toLinear(rgba, (size_t)width * height, current);
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        downsample(current, width, height, filter, next);
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        toSrgb(next, levels[i]);
+        current.swap(next);
+    }
+}
+
+// Resizes an RGBA8 image to outWidth x outHeight in linear light with the
+// windowed sinc (either direction), e.g. to fit a fixed texture array layer.
+inline void resizeImage(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t outWidth, uint32_t outHeight,
+                        std::vector<uint8_t> &out)
+{
+    using namespace mip_chain_detail;
+    std::vector<Pixel> linear, resized;
+    toLinear(rgba, (size_t)width * height, linear);
+    resample(linear, width, height, outWidth, outHeight, resized);
+    toSrgb(resized, out);
+}
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+#include "IndexedMesh.h"
+#include "MappedFile.h"
+#include "MeshOptimizer.h"
+
+// Single pass OBJ loader: the file is memory mapped, a cheap prepass counts the
+// records so every array is sized once, and v/vt/vn/f records are tokenized by
+// hand with std::from_chars. Faces with more than three corners are fan
+// triangulated, and negative (relative) indices are resolved. Large files can
+// be parsed in line-aligned chunks on several threads (see parseOBJBuffer).
+
+// One face corner, as 0-based indices into the position/uv/normal arrays.
+// vt and vn are -1 when the face does not reference them.
+struct OBJCorner {
+	int v, vt, vn;
+};
+
+// Record counts of a (part of a) file. corners is the number of triangle
+// corners the faces expand to once triangulated.
+struct OBJCounts {
+	size_t v = 0, vt = 0, vn = 0, corners = 0;
+};
+
+struct OBJData {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<OBJCorner> corners; // 3 per triangle
+	bool hasUVs = false;
+	bool hasNormals = false;
+};
+
+enum OBJRecord { OBJ_OTHER, OBJ_POSITION, OBJ_UV, OBJ_NORMAL, OBJ_FACE };
+
+inline bool objIsSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char * objSkipSpaces(const char * p, const char * end) {
+	while (p < end && objIsSpace(*p))
+		++p;
+	return p;
+}
+
+inline const char * objLineEnd(const char * p, const char * end) {
+	const char * nl = (const char *)memchr(p, '\n', end - p);
+	return nl ? nl : end;
+}
+
+// Classifies the line starting at p and returns a pointer past its keyword.
+inline OBJRecord objClassify(const char * p, const char * end, const char ** body) {
+	p = objSkipSpaces(p, end);
+	OBJRecord record = OBJ_OTHER;
+	if (p < end && *p == 'v') {
+		if (p + 1 < end && objIsSpace(p[1])) { record = OBJ_POSITION; p += 1; }
+		else if (p + 2 < end && p[1] == 't' && objIsSpace(p[2])) { record = OBJ_UV; p += 2; }
+		else if (p + 2 < end && p[1] == 'n' && objIsSpace(p[2])) { record = OBJ_NORMAL; p += 2; }
+	}
+	else if (p + 1 < end && *p == 'f' && objIsSpace(p[1])) {
+		record = OBJ_FACE;
+		p += 1;
+	}
+	*body = p;
+	return record;
+}
+
+inline bool objParseFloat(const char *& p, const char * end, float & value) {
+	p = objSkipSpaces(p, end);
+	if (p < end && *p == '+')
+		++p;
+	std::from_chars_result res = std::from_chars(p, end, value);
+	if (res.ec != std::errc())
+		return false;
+	p = res.ptr;
+	return true;
+}
+
+inline bool objParseInt(const char *& p, const char * end, int & value) {
+	if (p < end && *p == '+')
+		++p;
+	std::from_chars_result res = std::from_chars(p, end, value);
+	if (res.ec != std::errc())
+		return false;
+	p = res.ptr;
+	return true;
+}
+
+// Turns a 1-based OBJ index into a 0-based one. Negative indices count back
+// from the number of elements declared so far.
+inline int objResolve(int index, size_t declared) {
+	if (index > 0)
+		return index - 1;
+	if (index < 0)
+		return (int)declared + index;
+	return -1;
+}
+
+// Prepass over [begin, end): counts records without parsing any numbers.
+inline OBJCounts countOBJ(const char * begin, const char * end) {
+	OBJCounts counts;
+	const char * p = begin;
+	while (p < end) {
+		const char * lineEnd = objLineEnd(p, end);
+		const char * body;
+		switch (objClassify(p, lineEnd, &body)) {
+		case OBJ_POSITION: counts.v++; break;
+		case OBJ_UV: counts.vt++; break;
+		case OBJ_NORMAL: counts.vn++; break;
+		case OBJ_FACE: {
+			size_t groups = 0;
+			bool inGroup = false;
+			for (const char * c = body; c < lineEnd; ++c) {
+				bool space = objIsSpace(*c);
+				if (!space && !inGroup)
+					groups++;
+				inGroup = !space;
+			}
+			if (groups >= 3)
+				counts.corners += 3 * (groups - 2);
+			break;
+		}
+		default: break;
+		}
+		p = lineEnd + 1;
+	}
+	return counts;
+}
+
+// Parses the records in [begin, end), which must start at a line boundary.
+// base holds the number of each record declared before begin: positions, uvs
+// and normals are written at those offsets into the pre-sized arrays of out,
+// and relative indices are resolved against them. Triangulated corners are
+// appended to corners.
+inline bool parseOBJRange(const char * begin, const char * end, const OBJCounts & base,
+	OBJData & out, std::vector<OBJCorner> & corners, bool & usesUVs, bool & usesNormals) {
+
+	size_t v = base.v, vt = base.vt, vn = base.vn;
+	const char * p = begin;
+	while (p < end) {
+		const char * lineEnd = objLineEnd(p, end);
+		const char * body;
+		switch (objClassify(p, lineEnd, &body)) {
+		case OBJ_POSITION: {
+			glm::vec3 & vertex = out.positions[v++];
+			if (!objParseFloat(body, lineEnd, vertex.x) || !objParseFloat(body, lineEnd, vertex.y) || !objParseFloat(body, lineEnd, vertex.z)) {
+				printf("Malformed vertex at byte %ld\n", (long)(p - begin));
+				return false;
+			}
+			break;
+		}
+		case OBJ_UV: {
+			glm::vec2 & uv = out.uvs[vt++];
+			if (!objParseFloat(body, lineEnd, uv.x)) {
+				printf("Missing uv information at byte %ld\n", (long)(p - begin));
+				return false;
+			}
+			if (!objParseFloat(body, lineEnd, uv.y))
+				uv.y = 0.0f;
+			uv.y = -uv.y; // Invert V coordinate, same convention as loadOBJ/loadOBJ2.
+			break;
+		}
+		case OBJ_NORMAL: {
+			glm::vec3 & normal = out.normals[vn++];
+			if (!objParseFloat(body, lineEnd, normal.x) || !objParseFloat(body, lineEnd, normal.y) || !objParseFloat(body, lineEnd, normal.z)) {
+				printf("Missing normal information at byte %ld\n", (long)(p - begin));
+				return false;
+			}
+			break;
+		}
+		case OBJ_FACE: {
+			OBJCorner first = { -1, -1, -1 }, previous = { -1, -1, -1 };
+			int count = 0;
+			const char * c = body;
+			while (true) {
+				c = objSkipSpaces(c, lineEnd);
+				if (c >= lineEnd)
+					break;
+				OBJCorner corner = { -1, -1, -1 };
+				int index;
+				if (!objParseInt(c, lineEnd, index)) {
+					printf("File can't be read by our parser. 'f' format expected: v, v/vt, v//vn or v/vt/vn (byte %ld)\n", (long)(p - begin));
+					return false;
+				}
+				corner.v = objResolve(index, v);
+				if (c < lineEnd && *c == '/') {
+					++c;
+					if (c < lineEnd && *c != '/') {
+						if (!objParseInt(c, lineEnd, index))
+							return false;
+						corner.vt = objResolve(index, vt);
+						usesUVs = true;
+					}
+					if (c < lineEnd && *c == '/') {
+						++c;
+						if (!objParseInt(c, lineEnd, index))
+							return false;
+						corner.vn = objResolve(index, vn);
+						usesNormals = true;
+					}
+				}
+				if (count == 0)
+					first = corner;
+				else if (count >= 2) {
+					corners.push_back(first);
+					corners.push_back(previous);
+					corners.push_back(corner);
+				}
+				previous = corner;
+				count++;
+			}
+			break;
+		}
+		default: break;
+		}
+		p = lineEnd + 1;
+	}
+	return true;
+}
+
+// Checks every corner against the final array sizes, so expansion never reads
+// out of bounds on a broken file.
+inline bool validateOBJ(const OBJData & data) {
+	const int nv = (int)data.positions.size(), nvt = (int)data.uvs.size(), nvn = (int)data.normals.size();
+	for (const OBJCorner & c : data.corners) {
+		if (c.v < 0 || c.v >= nv || c.vt >= nvt || c.vn >= nvn || c.vt < -1 || c.vn < -1) {
+			printf("Face index out of range (v=%d vt=%d vn=%d)\n", c.v + 1, c.vt + 1, c.vn + 1);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Splits [begin, end) into up to chunkCount line-aligned ranges of similar size.
+inline std::vector<const char *> objSplitLines(const char * begin, const char * end, unsigned chunkCount) {
+	std::vector<const char *> bounds;
+	bounds.push_back(begin);
+	const size_t size = end - begin;
+	for (unsigned i = 1; i < chunkCount; i++) {
+		const char * p = begin + size * i / chunkCount;
+		if (p <= bounds.back())
+			continue;
+		p = objLineEnd(p, end);
+		if (p < end)
+			++p;
+		if (p > bounds.back() && p < end)
+			bounds.push_back(p);
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+// Parses a whole OBJ buffer. With threadCount > 1 the buffer is cut into
+// line-aligned chunks: every chunk is counted on its own thread, a prefix sum
+// over the counts gives each chunk the number of v/vt/vn records before it
+// (so relative indices resolve across chunk boundaries), the chunks are parsed
+// in parallel straight into the final arrays, and the triangulated corners
+// are concatenated at their prefix-summed offsets. The result is identical to
+// the single threaded parse, which is just the one-chunk case.
+inline bool parseOBJBuffer(const char * begin, const char * end, OBJData & out, unsigned threadCount = 1) {
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	// Below ~256 KB per chunk thread startup costs more than it saves.
+	const size_t minChunk = 256 * 1024;
+	threadCount = (unsigned)std::min<size_t>(threadCount, std::max<size_t>(1, (end - begin) / minChunk));
+
+	const std::vector<const char *> bounds = objSplitLines(begin, end, threadCount);
+	const size_t chunks = bounds.size() - 1;
+
+	auto forEachChunk = [&](auto && job) {
+		std::vector<std::thread> workers;
+		workers.reserve(chunks);
+		for (size_t i = 1; i < chunks; i++)
+			workers.emplace_back(job, i);
+		job((size_t)0);
+		for (std::thread & t : workers)
+			t.join();
+	};
+
+	std::vector<OBJCounts> counts(chunks);
+	forEachChunk([&](size_t i) { counts[i] = countOBJ(bounds[i], bounds[i + 1]); });
+
+	std::vector<OBJCounts> base(chunks + 1);
+	for (size_t i = 0; i < chunks; i++) {
+		base[i + 1].v = base[i].v + counts[i].v;
+		base[i + 1].vt = base[i].vt + counts[i].vt;
+		base[i + 1].vn = base[i].vn + counts[i].vn;
+		base[i + 1].corners = base[i].corners + counts[i].corners;
+	}
+	out.positions.resize(base[chunks].v);
+	out.uvs.resize(base[chunks].vt);
+	out.normals.resize(base[chunks].vn);
+	out.hasUVs = false;
+	out.hasNormals = false;
+
+	if (chunks == 1) {
+		out.corners.clear();
+		out.corners.reserve(base[1].corners);
+		if (!parseOBJRange(begin, end, OBJCounts(), out, out.corners, out.hasUVs, out.hasNormals))
+			return false;
+		return validateOBJ(out);
+	}
+
+	std::vector<std::vector<OBJCorner>> chunkCorners(chunks);
+	std::vector<char> ok(chunks), usesUVs(chunks), usesNormals(chunks);
+	forEachChunk([&](size_t i) {
+		bool uv = false, normal = false;
+		chunkCorners[i].reserve(counts[i].corners);
+		ok[i] = parseOBJRange(bounds[i], bounds[i + 1], base[i], out, chunkCorners[i], uv, normal);
+		usesUVs[i] = uv;
+		usesNormals[i] = normal;
+	});
+
+	std::vector<size_t> cornerBase(chunks + 1, 0);
+	for (size_t i = 0; i < chunks; i++) {
+		if (!ok[i])
+			return false;
+		out.hasUVs = out.hasUVs || usesUVs[i];
+		out.hasNormals = out.hasNormals || usesNormals[i];
+		cornerBase[i + 1] = cornerBase[i] + chunkCorners[i].size();
+	}
+	out.corners.resize(cornerBase[chunks]);
+	forEachChunk([&](size_t i) {
+		std::copy(chunkCorners[i].begin(), chunkCorners[i].end(), out.corners.begin() + cornerBase[i]);
+	});
+	return validateOBJ(out);
+}
+
+inline bool parseOBJ(const char * path, OBJData & out, unsigned threadCount = 1) {
+	MappedFile file;
+	if (!file.open(path)) {
+		printf("Impossible to open the file ! Are you in the right path ?\n");
+		printf("%s\n", path);
+		return false;
+	}
+	return parseOBJBuffer(file.begin(), file.end(), out, threadCount);
+}
+
+// Drop-in replacement for loadOBJ: one output vertex per triangle corner.
+// out_uvs / out_normals stay empty when the file has no uvs / normals.
+// threadCount > 1 parses the file in parallel chunks (0 = all cores).
+inline bool loadOBJ3(
+	const char * path,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec3> & out_normals,
+	std::vector<glm::vec2> & out_uvs,
+	unsigned threadCount = 1) {
+
+	OBJData data;
+	if (!parseOBJ(path, data, threadCount))
+		return false;
+
+	const size_t n = data.corners.size();
+	out_vertices.resize(n);
+	out_normals.resize(data.hasNormals ? n : 0);
+	out_uvs.resize(data.hasUVs ? n : 0);
+	for (size_t i = 0; i < n; i++) {
+		const OBJCorner & c = data.corners[i];
+		out_vertices[i] = data.positions[c.v];
+		if (data.hasNormals)
+			out_normals[i] = c.vn >= 0 ? data.normals[c.vn] : glm::vec3(0.0f);
+		if (data.hasUVs)
+			out_uvs[i] = c.vt >= 0 ? data.uvs[c.vt] : glm::vec2(0.0f);
+	}
+	return true;
+}
+
+// Indexed variant: every unique (position, uv, normal) triplet becomes one
+// vertex, so seams keep their own uvs/normals while shared corners are stored
+// once. Missing uvs/normals are zero. With optimize set, the result is
+// reordered for the vertex cache, overdraw and fetch locality (optimizeMesh).
+inline bool loadOBJ3Indexed(const char * path, IndexedMesh & out, unsigned threadCount = 1, bool optimize = true) {
+	OBJData data;
+	if (!parseOBJ(path, data, threadCount))
+		return false;
+
+	VertexWelder<OBJCorner> welder(data.corners.size());
+	out.indices.resize(data.corners.size());
+	for (size_t i = 0; i < data.corners.size(); i++)
+		out.indices[i] = welder.insert(data.corners[i]);
+
+	const std::vector<OBJCorner> & unique = welder.keys();
+	out.vertices.resize(unique.size());
+	for (size_t i = 0; i < unique.size(); i++) {
+		const OBJCorner & c = unique[i];
+		MeshVertex & vertex = out.vertices[i];
+		vertex.position = data.positions[c.v];
+		vertex.normal = c.vn >= 0 ? data.normals[c.vn] : glm::vec3(0.0f);
+		vertex.uv = c.vt >= 0 ? data.uvs[c.vt] : glm::vec2(0.0f);
+	}
+	if (optimize)
+		optimizeMesh(out);
+	return true;
+}
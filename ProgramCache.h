@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "ContentHash.h"
+#include "MappedFile.h"
+
+// Program binary cache. A cache file is a fixed header followed by the
+// driver's program binary from glGetProgramBinary. Files are named after a
+// key hashing every shader source exactly as compiled together with the GL
+// vendor, renderer and version strings, so editing a shader or updating the
+// driver simply misses and writes a new file. A warm start maps the file and
+// hands the binary to glProgramBinary without compiling any GLSL. The header
+// also records how long the original compile and link took, so a hit can
+// report the time it saved.
+
+const char PROGRAM_CACHE_MAGIC[4] = {'W', 'Z', 'P', 'B'};
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat; // as returned by glGetProgramBinary
+    uint32_t binaryBytes;
+    float buildMs; // compile + link time of the miss that wrote it
+    uint32_t reserved;
+};
+static_assert(sizeof(ProgramCacheHeader) == 32, "program cache header is 32 bytes");
+
+// Key for a program built from sources (in stage order) on the driver
+// identified by vendor/renderer/version. Lengths are hashed too so moving
+// text from one stage to the next changes the key.
+inline uint64_t programCacheKey(const std::vector<std::string> &sources, const char *vendor, const char *renderer, const char *version)
+{
+    uint64_t key = PROGRAM_CACHE_VERSION;
+    for (const char *driver : {vendor, renderer, version})
+        key = hashBytes64(driver ? driver : "", driver ? strlen(driver) : 0, key);
+    for (const std::string &source : sources)
+    {
+        uint64_t length = source.size();
+        key = hashBytes64(&length, sizeof(length), key);
+        key = hashBytes64(source.data(), source.size(), key);
+    }
+    return key;
+}
+
+// <directory>/<key as 16 hex digits>.glprogram
+inline std::string programCachePath(const std::string &directory, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.glprogram", (unsigned long long)key);
+    return directory.empty() ? std::string(name) : directory + "/" + name;
+}
+
+// Returns the header if [data, data + size) is a complete cache of the
+// current version for key, else nullptr. The binary follows the header.
+inline const ProgramCacheHeader *validateProgramCache(const char *data, size_t size, uint64_t key)
+{
+    if (!data || size < sizeof(ProgramCacheHeader))
+        return nullptr;
+    const ProgramCacheHeader *header = (const ProgramCacheHeader *)data;
+    if (memcmp(header->magic, PROGRAM_CACHE_MAGIC, 4) != 0 || header->version != PROGRAM_CACHE_VERSION || header->key != key)
+        return nullptr;
+    if (header->binaryBytes == 0 || header->binaryBytes != size - sizeof(ProgramCacheHeader))
+        return nullptr;
+    return header;
+}
+
+inline void buildProgramCache(uint64_t key, uint32_t binaryFormat, const void *binary, uint32_t binaryBytes, float buildMs,
+                              std::vector<char> &image)
+{
+    ProgramCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.binaryFormat = binaryFormat;
+    header.binaryBytes = binaryBytes;
+    header.buildMs = buildMs;
+    image.resize(sizeof(header) + binaryBytes);
+    memcpy(image.data(), &header, sizeof(header));
+    memcpy(image.data() + sizeof(header), binary, binaryBytes);
+}
+
+// A cache file mapped for reading. header is null unless the file is a valid
+// cache for key.
+struct ProgramCacheFile
+{
+    MappedFile file;
+    const ProgramCacheHeader *header = nullptr;
+
+    bool open(const char *path, uint64_t key)
+    {
+        header = nullptr;
+        if (!file.open(path))
+            return false;
+        header = validateProgramCache(file.data(), file.size(), key);
+        if (!header)
+            file.close();
+        return header != nullptr;
+    }
+
+    const char *binary() const { return (const char *)(header + 1); }
+};
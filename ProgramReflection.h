@@ -0,0 +1,194 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Uniform reflection. ProgramReflection reads every active uniform of a
+// linked program once (glGetActiveUniform) into a table sorted by name;
+// get() turns a name into a typed handle at setup time, and from then on
+// drawing code only calls handle.set(). A handle remembers the last value
+// it uploaded and skips glUniform* when the value has not changed, so
+// per-draw uniforms that stay put (view, projection, material...) cost a
+// compare instead of a driver call.
+//
+// uniformStats().lookups counts every by-name query, including the ones
+// reflect() makes; it should not move once the first frame starts.
+
+struct UniformStats
+{
+    size_t lookups = 0; // uniform locations resolved from a name
+    size_t uploads = 0; // glUniform* calls made by handles
+    size_t skipped = 0; // set() calls with an unchanged value
+};
+
+inline UniformStats &uniformStats()
+{
+    static UniformStats stats;
+    return stats;
+}
+
+namespace uniform_detail
+{
+    inline void upload(GLint location, const glm::mat4 *values, GLsizei count) { glUniformMatrix4fv(location, count, GL_FALSE, glm::value_ptr(values[0])); }
+    inline void upload(GLint location, const glm::mat3 *values, GLsizei count) { glUniformMatrix3fv(location, count, GL_FALSE, glm::value_ptr(values[0])); }
+    inline void upload(GLint location, const glm::vec4 *values, GLsizei count) { glUniform4fv(location, count, glm::value_ptr(values[0])); }
+    inline void upload(GLint location, const glm::vec3 *values, GLsizei count) { glUniform3fv(location, count, glm::value_ptr(values[0])); }
+    inline void upload(GLint location, const float *values, GLsizei count) { glUniform1fv(location, count, values); }
+    inline void upload(GLint location, const GLint *values, GLsizei count) { glUniform1iv(location, count, values); }
+} // namespace uniform_detail
+
+// One uniform of one program; set() needs that program current. A default
+// constructed handle (uniform not active in the program) ignores set().
+template <typename T, GLenum GLType>
+class Uniform
+{
+public:
+    static const GLenum TYPE = GLType; // glGetActiveUniform type this binds to
+
+    Uniform() = default;
+    Uniform(GLint location, GLint) : mLocation(location) {}
+
+    bool valid() const { return mLocation >= 0; }
+
+    void set(const T &value)
+    {
+        if (mLocation < 0)
+            return;
+        if (mHasValue && memcmp(&mValue, &value, sizeof(T)) == 0)
+        {
+            uniformStats().skipped++;
+            return;
+        }
+        mValue = value;
+        mHasValue = true;
+        uniform_detail::upload(mLocation, &mValue, 1);
+        uniformStats().uploads++;
+    }
+
+private:
+    GLint mLocation = -1;
+    bool mHasValue = false;
+    T mValue{};
+};
+
+// A uniform array; set() uploads the first count elements if any differ from
+// what was last uploaded.
+template <typename T, GLenum GLType>
+class UniformArray
+{
+public:
+    static const GLenum TYPE = GLType;
+
+    UniformArray() = default;
+    UniformArray(GLint location, GLint size) : mLocation(location), mValues(size) {}
+
+    bool valid() const { return mLocation >= 0; }
+    GLsizei size() const { return (GLsizei)mValues.size(); }
+
+    void set(const T *values, GLsizei count)
+    {
+        count = std::min(count, size());
+        if (mLocation < 0 || count <= 0)
+            return;
+        if (count <= mUploaded && memcmp(mValues.data(), values, count * sizeof(T)) == 0)
+        {
+            uniformStats().skipped++;
+            return;
+        }
+        memcpy(mValues.data(), values, count * sizeof(T));
+        mUploaded = std::max(mUploaded, count);
+        uniform_detail::upload(mLocation, mValues.data(), count);
+        uniformStats().uploads++;
+    }
+
+private:
+    GLint mLocation = -1;
+    GLsizei mUploaded = 0; // leading elements known to match the program
+    std::vector<T> mValues;
+};
+
+typedef Uniform<glm::mat4, GL_FLOAT_MAT4> Mat4Uniform;
+typedef Uniform<glm::mat3, GL_FLOAT_MAT3> Mat3Uniform;
+typedef Uniform<glm::vec4, GL_FLOAT_VEC4> Vec4Uniform;
+typedef Uniform<glm::vec3, GL_FLOAT_VEC3> Vec3Uniform;
+typedef Uniform<float, GL_FLOAT> FloatUniform;
+typedef Uniform<GLint, GL_INT> IntUniform;
+typedef Uniform<GLint, GL_BOOL> BoolUniform;
+typedef Uniform<GLint, GL_SAMPLER_2D> Sampler2DUniform;
+typedef Uniform<GLint, GL_SAMPLER_2D_ARRAY> Sampler2DArrayUniform;
+typedef UniformArray<glm::vec3, GL_FLOAT_VEC3> Vec3ArrayUniform;
+
+struct UniformInfo
+{
+    std::string name; // arrays without the trailing "[0]"
+    GLint location;
+    GLenum type;
+    GLint size; // array length, 1 for plain uniforms
+};
+
+class ProgramReflection
+{
+public:
+    // Reads the active uniforms of a linked program. Uniform block members
+    // have no location and are left out.
+    void reflect(GLuint program)
+    {
+        mProgram = program;
+        mUniforms.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> name(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+            UniformInfo info = {std::string(name.data(), length), -1, type, size};
+            info.location = glGetUniformLocation(program, info.name.c_str());
+            uniformStats().lookups++;
+            if (info.location < 0)
+                continue;
+            if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+                info.name.resize(info.name.size() - 3);
+            mUniforms.push_back(info);
+        }
+        std::sort(mUniforms.begin(), mUniforms.end(), [](const UniformInfo &a, const UniformInfo &b) { return a.name < b.name; });
+    }
+
+    GLuint program() const { return mProgram; }
+    const std::vector<UniformInfo> &uniforms() const { return mUniforms; }
+
+    // Setup time only. Returns an inert handle if the program has no active
+    // uniform of that name (the compiler may drop unused ones) or its type
+    // does not match the handle's.
+    template <typename Handle>
+    Handle get(const char *name) const
+    {
+        uniformStats().lookups++;
+        auto it = std::lower_bound(mUniforms.begin(), mUniforms.end(), name,
+                                   [](const UniformInfo &info, const char *key) { return info.name.compare(key) < 0; });
+        if (it == mUniforms.end() || it->name != name)
+            return Handle();
+        if (it->type != Handle::TYPE)
+        {
+            std::cout << "WARNING: Uniform " << name << " of program " << mProgram << " has type 0x" << std::hex << it->type
+                      << ", handle expects 0x" << Handle::TYPE << std::dec << std::endl;
+            return Handle();
+        }
+        return Handle(it->location, it->size);
+    }
+
+private:
+    GLuint mProgram = 0;
+    std::vector<UniformInfo> mUniforms;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Frame render queue. Draws are submitted as packets, a command plus a 64-bit
+// sort key, in whatever order the scene code produces them; flush() sorts the
+// keys with a radix sort and executes the commands in key order, so draws
+// sharing a program, material and vertex array end up next to each other and
+// opaque geometry within them goes front to back for early-Z.
+//
+// Key layout, most significant bits first:
+//   pass      4 bits  (RenderPass: shadow map, opaque, background)
+//   program   8 bits  low bits of the program name
+//   material  8 bits
+//   vao      12 bits  low bits of the vertex array name
+//   depth    32 bits  view distance as float bits (ascending: front to back)
+// Truncated names can only merge groups that would otherwise be apart; the
+// commands carry the full state.
+
+enum RenderPass : uint32_t
+{
+    RENDER_PASS_SHADOW = 0,
+    RENDER_PASS_OPAQUE = 1,
+    RENDER_PASS_BACKGROUND = 2, // after all opaque geometry (the dome)
+};
+const uint32_t RENDER_PASS_COUNT = 3;
+
+inline uint64_t renderSortKey(uint32_t pass, uint32_t program, uint32_t material, uint32_t vao, float depth)
+{
+    // non-negative floats order the same as their bit patterns
+    float clamped = depth > 0.0f ? depth : 0.0f;
+    uint32_t depthBits;
+    memcpy(&depthBits, &clamped, sizeof(depthBits));
+    return ((uint64_t)(pass & 0xFu) << 60) | ((uint64_t)(program & 0xFFu) << 52) | ((uint64_t)(material & 0xFFu) << 44) |
+           ((uint64_t)(vao & 0xFFFu) << 32) | depthBits;
+}
+
+inline uint32_t renderKeyPass(uint64_t key) { return (uint32_t)(key >> 60); }
+
+struct RenderSortItem
+{
+    uint64_t key;
+    uint32_t index; // command
+};
+
+// Stable LSD radix sort by key, 8 bits per pass. Bytes every key shares
+// (most of the high ones in a typical frame) cost one counting pass and no
+// scatter.
+inline void radixSortRenderItems(std::vector<RenderSortItem> &items, std::vector<RenderSortItem> &scratch)
+{
+    if (items.size() < 2)
+        return;
+    scratch.resize(items.size());
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t offsets[256] = {};
+        for (const RenderSortItem &item : items)
+            offsets[(item.key >> shift) & 0xFF]++;
+        if (offsets[(items[0].key >> shift) & 0xFF] == items.size())
+            continue;
+        size_t offset = 0;
+        for (size_t &count : offsets)
+        {
+            size_t bucket = count;
+            count = offset;
+            offset += bucket;
+        }
+        for (const RenderSortItem &item : items)
+            scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+        items.swap(scratch);
+    }
+}
+
+template <typename Command>
+class RenderQueue
+{
+public:
+    void submit(uint64_t key, const Command &command)
+    {
+        mItems.push_back({key, (uint32_t)mCommands.size()});
+        mCommands.push_back(command);
+    }
+
+    size_t size() const { return mItems.size(); }
+
+    // Sorts the packets and calls execute(key, command) for each in key
+    // order, then empties the queue (keeping its storage).
+    template <typename Execute>
+    void flush(Execute execute)
+    {
+        radixSortRenderItems(mItems, mScratch);
+        for (const RenderSortItem &item : mItems)
+            execute(item.key, mCommands[item.index]);
+        mItems.clear();
+        mCommands.clear();
+    }
+
+private:
+    std::vector<RenderSortItem> mItems, mScratch;
+    std::vector<Command> mCommands;
+};
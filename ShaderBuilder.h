@@ -0,0 +1,298 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MeshCache.h"
+#include "ProgramCache.h"
+#include "ShaderPermutations.h"
+
+// Builds shader programs without stalling on each one. submit() reads the
+// sources and issues every compile and the link straight away, checking
+// nothing, so a driver with KHR_parallel_shader_compile (or the ARB version)
+// compiles them on its own threads while the caller carries on. finish()
+// polls GL_COMPLETION_STATUS_KHR until all are done, then checks them and
+// prints any compile and link errors as one report. Without the extension
+// the driver compiles when first asked for a status, which finish() also
+// covers. Adding programs therefore costs roughly the slowest compile
+// instead of the sum of all of them.
+//
+// With the program cache on, a program whose binary was saved by an earlier
+// run (ProgramCache.h) is restored in submit() and never compiled; new
+// programs are saved once finish() has seen them link. Permutations pass
+// their #defines to submit(); they are part of the source that is hashed.
+
+struct ShaderBuildStats
+{
+    size_t programs = 0;
+    size_t cacheHits = 0;
+    size_t cacheMisses = 0; // compiled, and saved if the driver offers binaries
+    size_t failures = 0;
+    double submitMs = 0.0;  // time spent issuing the work
+    double waitMs = 0.0;    // time finish() waited for the driver
+    double savedMs = 0.0;   // build time skipped by cache hits
+};
+
+class ShaderBuilder
+{
+public:
+    // GL thread, with a context current.
+    explicit ShaderBuilder(bool useProgramCache = true)
+    {
+        mParallel = GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+        if (GLEW_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu); // as many as the driver likes
+        else if (GLEW_ARB_parallel_shader_compile)
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+        GLint formats = 0;
+        if (useProgramCache && GLEW_ARB_get_program_binary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        mUseCache = formats > 0;
+        if (useProgramCache && !mUseCache)
+            std::cout << "Program cache disabled: driver offers no program binary formats" << std::endl;
+    }
+
+    bool parallel() const { return mParallel; }
+
+    // Queues a program and returns its name. The name is valid at once, but
+    // using it before finish() waits for the driver like any GL call would.
+    // defines go after the #version line of both stages.
+    GLuint submit(const char *vertexPath, const char *fragmentPath, const std::string &defines = std::string())
+    {
+        auto start = std::chrono::steady_clock::now();
+        Build build;
+        build.vertexPath = vertexPath;
+        build.name = fragmentPath;
+        if (!defines.empty())
+        {
+            // e.g. "scene.glsl [EMISSIVE 1 HIT_FLASH 0]"
+            std::string list;
+            for (size_t begin = 0, end; begin < defines.size(); begin = end + 1)
+            {
+                end = std::min(defines.find('\n', begin), defines.size());
+                std::string line = defines.substr(begin, end - begin);
+                if (line.compare(0, 8, "#define ") == 0)
+                    line = line.substr(8);
+                if (!line.empty())
+                    list += (list.empty() ? "" : " ") + line;
+            }
+            build.name += " [" + list + "]";
+        }
+        build.start = start;
+        std::string sources[2] = {insertShaderDefines(readSource(vertexPath), defines),
+                                  insertShaderDefines(readSource(fragmentPath), defines)};
+        if (mUseCache)
+        {
+            build.key = programCacheKey({sources[0], sources[1]}, (const char *)glGetString(GL_VENDOR),
+                                        (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+            std::string directory(vertexPath);
+            size_t slash = directory.find_last_of("/\\");
+            directory = slash == std::string::npos ? std::string() : directory.substr(0, slash);
+            build.cachePath = programCachePath(directory, build.key);
+            float buildMs = 0.0f;
+            build.program = loadBinary(build.cachePath, build.key, buildMs);
+            if (build.program)
+            {
+                double loadMs = elapsedMs(start);
+                mStats.cacheHits++;
+                mStats.savedMs += std::max(0.0, buildMs - loadMs);
+                std::cout << "Program cache hit: " << build.name << " restored in " << loadMs << " ms (built in " << buildMs << " ms)"
+                          << std::endl;
+                mStats.programs++;
+                mStats.submitMs += loadMs;
+                return build.program;
+            }
+        }
+        const GLenum types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+        build.program = glCreateProgram();
+        for (int i = 0; i < 2; i++)
+        {
+            const char *src = sources[i].c_str();
+            build.shaders[i] = glCreateShader(types[i]);
+            glShaderSource(build.shaders[i], 1, &src, NULL);
+            glCompileShader(build.shaders[i]);
+            glAttachShader(build.program, build.shaders[i]);
+        }
+        if (mUseCache)
+            glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(build.program);
+        mPending.push_back(build);
+        mStats.programs++;
+        mStats.submitMs += elapsedMs(start);
+        return build.program;
+    }
+
+    // Non-blocking: true once every submitted program has finished building
+    // (always true without the extension, whose driver builds on demand).
+    bool ready()
+    {
+        bool done = true;
+        for (Build &build : mPending)
+            done = poll(build) && done;
+        return done;
+    }
+
+    // Waits for every submitted program, saves new ones to the program cache
+    // and reports all errors at once. Returns false if any program failed.
+    bool finish()
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (!ready())
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        std::ostringstream errors;
+        size_t failures = 0;
+        for (Build &build : mPending)
+        {
+            GLint linked = GL_FALSE;
+            glGetProgramiv(build.program, GL_LINK_STATUS, &linked);
+            if (!build.buildMs)
+                build.buildMs = (float)elapsedMs(build.start);
+            if (!linked)
+            {
+                failures++;
+                errors << "  " << build.vertexPath << " + " << build.name << "\n";
+                for (GLuint shader : build.shaders)
+                {
+                    GLint compiled = GL_FALSE;
+                    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+                    if (!compiled)
+                        errors << "    compile: " << shaderLog(shader);
+                }
+                errors << "    link: " << programLog(build.program);
+            }
+            for (GLuint shader : build.shaders)
+            {
+                glDetachShader(build.program, shader);
+                glDeleteShader(shader);
+            }
+            if (linked && !build.cachePath.empty())
+            {
+                saveBinary(build);
+                mStats.cacheMisses++;
+                std::cout << "Program cache miss: " << build.name << " compiled and linked in " << build.buildMs << " ms"
+                          << std::endl;
+            }
+        }
+        mPending.clear();
+        mStats.failures += failures;
+        mStats.waitMs += elapsedMs(start);
+        if (failures)
+            std::cout << "ERROR: " << failures << " shader program(s) failed to build\n" << errors.str() << std::flush;
+        return failures == 0;
+    }
+
+    ShaderBuildStats stats() const { return mStats; }
+
+private:
+    struct Build
+    {
+        const char *vertexPath = nullptr;
+        std::string name; // fragment path and defines, for messages
+        GLuint program = 0;
+        GLuint shaders[2] = {0, 0};
+        uint64_t key = 0;
+        std::string cachePath;
+        std::chrono::steady_clock::time_point start;
+        float buildMs = 0.0f; // set when first seen complete
+    };
+
+    static double elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static std::string readSource(const char *path)
+    {
+        std::ifstream file(path);
+        if (!file.is_open())
+        {
+            std::cout << "ERROR: Unable to read shader file " << path << std::endl;
+            return "";
+        }
+        std::stringstream ss;
+        ss << file.rdbuf();
+        return ss.str();
+    }
+
+    static std::string shaderLog(GLuint shader)
+    {
+        GLint length = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        std::string log(std::max(length, 1), '\0');
+        glGetShaderInfoLog(shader, (GLsizei)log.size(), NULL, &log[0]);
+        log.resize(strlen(log.c_str()));
+        return log.empty() || log.back() != '\n' ? log + "\n" : log;
+    }
+
+    static std::string programLog(GLuint program)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        std::string log(std::max(length, 1), '\0');
+        glGetProgramInfoLog(program, (GLsizei)log.size(), NULL, &log[0]);
+        log.resize(strlen(log.c_str()));
+        return log.empty() || log.back() != '\n' ? log + "\n" : log;
+    }
+
+    bool poll(Build &build)
+    {
+        if (build.buildMs)
+            return true;
+        if (!mParallel)
+            return true;
+        GLint complete = GL_FALSE;
+        glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &complete);
+        if (complete)
+            build.buildMs = std::max((float)elapsedMs(build.start), 0.001f);
+        return complete != GL_FALSE;
+    }
+
+    // 0 if there is no valid cache file or the driver rejects the binary (a
+    // driver update can invalidate binaries under the same version string).
+    static GLuint loadBinary(const std::string &cachePath, uint64_t key, float &buildMs)
+    {
+        ProgramCacheFile cache;
+        if (!cache.open(cachePath.c_str(), key))
+            return 0;
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, cache.header->binaryFormat, cache.binary(), cache.header->binaryBytes);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            glDeleteProgram(program);
+            return 0;
+        }
+        buildMs = cache.header->buildMs;
+        return program;
+    }
+
+    static void saveBinary(const Build &build)
+    {
+        GLint length = 0;
+        glGetProgramiv(build.program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum binaryFormat = 0;
+        glGetProgramBinary(build.program, length, &length, &binaryFormat, binary.data());
+        std::vector<char> image;
+        buildProgramCache(build.key, binaryFormat, binary.data(), (uint32_t)length, build.buildMs, image);
+        if (!writeCacheFile(build.cachePath.c_str(), image))
+            std::cout << "WARNING: Unable to write program cache " << build.cachePath << std::endl;
+    }
+
+    bool mParallel = false;
+    bool mUseCache = false;
+    std::vector<Build> mPending;
+    ShaderBuildStats mStats;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+// Scene shader permutations. Every feature the scene shader can be built
+// with or without is a bit of a mask; a variant is the shader compiled with
+// #defines for one mask, so a draw that has no use for a feature runs code
+// without it rather than branching past it per fragment. Variants are indexed by
+// their mask and each is cached as a program binary under its own key (the
+// defines are part of the compiled source).
+//
+// Defines set for a mask:
+//   EMISSIVE    0/1  add the material's emissive color
+//   HIT_FLASH   0/1  add the material's hit flash
+//   PCF_TAPS    0/9  shadow map taps (0: no shadow lookup)
+//   MAX_LIGHTS  0/n  point lights looped over (0: no loop)
+//   INSTANCED   0/1  model and normal matrices are per-instance attributes
+
+enum ShaderFeature : uint32_t
+{
+    SHADER_EMISSIVE = 1u << 0,
+    SHADER_HIT_FLASH = 1u << 1,
+    SHADER_SHADOWS = 1u << 2,
+    SHADER_POINT_LIGHTS = 1u << 3,
+    SHADER_INSTANCED = 1u << 4,
+};
+const uint32_t SHADER_FEATURE_COUNT = 5;
+const uint32_t SHADER_VARIANT_COUNT = 1u << SHADER_FEATURE_COUNT;
+const uint32_t SHADER_ALL_FEATURES = SHADER_VARIANT_COUNT - 1;
+
+// The #define block for features; pcfTaps and maxLights are the values used
+// when SHADER_SHADOWS and SHADER_POINT_LIGHTS are set.
+inline std::string shaderVariantDefines(uint32_t features, int pcfTaps, int maxLights)
+{
+    std::string defines;
+    defines += "#define EMISSIVE " + std::to_string((features & SHADER_EMISSIVE) ? 1 : 0) + "\n";
+    defines += "#define HIT_FLASH " + std::to_string((features & SHADER_HIT_FLASH) ? 1 : 0) + "\n";
+    defines += "#define PCF_TAPS " + std::to_string((features & SHADER_SHADOWS) ? pcfTaps : 0) + "\n";
+    defines += "#define MAX_LIGHTS " + std::to_string((features & SHADER_POINT_LIGHTS) ? maxLights : 0) + "\n";
+    defines += "#define INSTANCED " + std::to_string((features & SHADER_INSTANCED) ? 1 : 0) + "\n";
+    return defines;
+}
+
+// Source with defines inserted after its #version line, which GLSL requires
+// to come first.
+inline std::string insertShaderDefines(const std::string &source, const std::string &defines)
+{
+    if (defines.empty())
+        return source;
+    size_t version = source.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+    if (lineEnd == std::string::npos)
+        return defines + source;
+    return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+}
@@ -0,0 +1,56 @@
+#version 330 core
+
+in vec3 vQuadPos;
+flat in vec4 vSphere;
+flat in float vPhase;
+
+// ---------- materials (bound once per frame, indexed per draw) ----------
+#define MAX_MATERIALS 64
+struct Material {
+    vec4  baseColor; // rgb multiplies the texel (0 for pure emitters)
+    vec4  emissive;  // rgb added after lighting
+    vec4  hitFlash;  // rgb color, a strength 0..1
+    ivec4 layer;     // x: layer in materialTextures, y: finest resident mip
+};
+layout(std140) uniform MaterialBlock {
+    Material materials[MAX_MATERIALS];
+};
+uniform int uMaterial;
+
+// ---------- per-frame constants (FrameData in Assignment2.cpp) ----------
+layout(std140) uniform FrameBlock {
+    mat4  view;
+    mat4  projection;
+    mat4  lightSpaceMatrix; // sun shadow map
+    vec3  viewPos;
+    float time;             // seconds since startup
+    vec3  lightPos;         // sun, animated around the origin
+    float deltaTime;
+    vec4  lightColor;       // rgb
+};
+
+out vec4 FragColor;
+
+void main()
+{
+    // eye ray through this fragment against the sphere
+    vec3 dir = normalize(vQuadPos - viewPos);
+    vec3 oc = viewPos - vSphere.xyz;
+    float b = dot(oc, dir);
+    float h = b * b - (dot(oc, oc) - vSphere.w * vSphere.w);
+    if (h < 0.0)
+        discard;
+    float t = max(-b - sqrt(h), 0.0);
+    vec3 hit = viewPos + dir * t;
+    vec3 N = (hit - vSphere.xyz) / vSphere.w;
+
+    // depth of the sphere surface, not of the quad
+    vec4 clip = projection * view * vec4(hit, 1.0);
+    float ndcDepth = clip.z / clip.w;
+    gl_FragDepth = (gl_DepthRange.diff * ndcDepth + gl_DepthRange.near + gl_DepthRange.far) * 0.5;
+
+    // emissive core, brightest facing the eye, flickering per fireball
+    float facing = max(dot(N, -dir), 0.0);
+    float flicker = 0.9 + 0.1 * sin(time * 23.0 + vPhase * 3.0);
+    FragColor = vec4(materials[uMaterial].emissive.rgb * mix(0.75, 1.0, facing) * flicker, 1.0);
+}
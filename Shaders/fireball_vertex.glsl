@@ -0,0 +1,47 @@
+#version 330 core
+
+// Fireball impostors: one camera-facing quad per live projectile
+// (FireballInstance in Assignment2.cpp), just big enough to cover the
+// sphere's silhouette. fireball_fragment.glsl ray-traces the sphere in it.
+layout (location = 0) in vec2  aCorner; // quad corner in [-1,1]
+layout (location = 1) in vec4  aSphere; // per instance: xyz center, w radius
+layout (location = 2) in float aPhase;  // per instance: animation phase (radians)
+
+// ---------- per-frame constants (FrameData in Assignment2.cpp) ----------
+layout(std140) uniform FrameBlock {
+    mat4  view;
+    mat4  projection;
+    mat4  lightSpaceMatrix; // sun shadow map
+    vec3  viewPos;
+    float time;             // seconds since startup
+    vec3  lightPos;         // sun, animated around the origin
+    float deltaTime;
+    vec4  lightColor;       // rgb
+};
+
+out vec3 vQuadPos;          // world-space point on the quad
+flat out vec4 vSphere;      // center, animated radius
+flat out float vPhase;
+
+void main()
+{
+    // the radius pulses, out of step between fireballs
+    float radius = aSphere.w * (1.0 + 0.08 * sin(time * 9.0 + aPhase));
+    vec3 center = aSphere.xyz;
+
+    vec3 toEye = viewPos - center;
+    float d = length(toEye);
+    vec3 forward = toEye / max(d, 1e-4);
+    vec3 right = normalize(cross(abs(forward.y) > 0.99 ? vec3(1.0, 0.0, 0.0) : vec3(0.0, 1.0, 0.0), forward));
+    vec3 up = cross(forward, right);
+
+    // the eye's tangent cone around the sphere cuts the plane through the
+    // center (facing the eye) in a circle of this radius
+    float extent = radius * d / sqrt(max(d * d - radius * radius, 1e-4));
+    vec3 corner = center + (right * aCorner.x + up * aCorner.y) * extent;
+
+    vQuadPos = corner;
+    vSphere = vec4(center, radius);
+    vPhase = aPhase;
+    gl_Position = projection * view * vec4(corner, 1.0);
+}
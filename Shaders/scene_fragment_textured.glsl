@@ -7,33 +7,66 @@ in VS_OUT {
     vec4 FragPosLightSpace;
 } fs_in;
 
-// ---------- textures ----------
-uniform sampler2D texture_diffuse1;  // surface base color
-uniform sampler2D shadowMap;         // sun shadow depth
-
-// ---------- camera ----------
-uniform vec3 viewPos;
-
-// ---------- sun (directional-ish) ----------
-uniform vec3 lightPos;   // you animate this around the origin
-uniform vec3 lightColor; // e.g., white-ish
+// ---------- permutation features (ShaderPermutations.h) ----------
+// The application compiles one variant per feature mask with these defined;
+// the defaults are the full-featured shader.
+#ifndef EMISSIVE
+#define EMISSIVE 1
+#endif
+#ifndef HIT_FLASH
+#define HIT_FLASH 1
+#endif
+#ifndef PCF_TAPS
+#define PCF_TAPS 9   // 9: 3x3 kernel, 1: single tap, 0: no shadow lookup
+#endif
 
-// ---------- snake hit flash ----------
-uniform float hitFlashStrength; // 0..1
-uniform vec3  hitFlashColor;    // usually red
-
-// ---------- fireball point lights ----------
+// ---------- textures ----------
+uniform sampler2DArray materialTextures; // one layer per material texture
+uniform sampler2D shadowMap;             // sun shadow depth
+
+// ---------- materials (bound once per frame, indexed per draw) ----------
+#define MAX_MATERIALS 64
+struct Material {
+    vec4  baseColor; // rgb multiplies the texel (0 for pure emitters)
+    vec4  emissive;  // rgb added after lighting
+    vec4  hitFlash;  // rgb color, a strength 0..1
+    ivec4 layer;     // x: layer in materialTextures, y: finest resident mip
+};
+layout(std140) uniform MaterialBlock {
+    Material materials[MAX_MATERIALS];
+};
+uniform int uMaterial;
+
+// ---------- per-frame constants (FrameData in Assignment2.cpp) ----------
+layout(std140) uniform FrameBlock {
+    mat4  view;
+    mat4  projection;
+    mat4  lightSpaceMatrix; // sun shadow map
+    vec3  viewPos;
+    float time;             // seconds since startup
+    vec3  lightPos;         // sun, animated around the origin
+    float deltaTime;
+    vec4  lightColor;       // rgb
+};
+
+// ---------- fireball point lights (LightData in Assignment2.cpp) ----------
 #define MAX_FIREBALLS 32
-uniform int  uFireballCount;
-uniform vec3 uFireballPos[MAX_FIREBALLS];
-uniform vec3 uFireballColor[MAX_FIREBALLS];
-uniform float uFireballRadius; // falloff distance scale (try 6..10)
-
-// ---------- fireball emissive toggle on the sphere itself ----------
-uniform float isFireball; // 1.0 when drawing the fireball mesh
+struct FireballLight {
+    vec4 position; // xyz
+    vec4 color;    // rgb
+};
+layout(std140) uniform LightBlock {
+    FireballLight fireballs[MAX_FIREBALLS];
+    int   fireballCount;
+    float fireballRadius; // falloff distance scale (try 6..10)
+};
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS MAX_FIREBALLS
+#endif
 
 out vec4 FragColor;
 
+#if PCF_TAPS > 0
 // ------- shadow helper (PCF) -------
 float ShadowFactor(vec4 fragPosLightSpace, vec3 N, vec3 L)
 {
@@ -48,6 +81,7 @@ float ShadowFactor(vec4 fragPosLightSpace, vec3 N, vec3 L)
     float bias = max(0.0005 * (1.0 - dot(N, L)), 0.0002);
     float currentDepth = projCoords.z;
 
+#if PCF_TAPS >= 9
     // 3x3 PCF
     float shadow = 0.0;
     vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
@@ -59,7 +93,11 @@ float ShadowFactor(vec4 fragPosLightSpace, vec3 N, vec3 L)
     }
     shadow /= 9.0;
     return shadow;
+#else
+    return currentDepth - bias > texture(shadowMap, projCoords.xy).r ? 1.0 : 0.0;
+#endif
 }
+#endif
 
 // ------- simple point light with quadratic falloff -------
 vec3 PointLight(vec3 lp, vec3 lc, vec3 fragPos, vec3 N)
@@ -72,7 +110,7 @@ vec3 PointLight(vec3 lp, vec3 lc, vec3 fragPos, vec3 N)
 
     // Smooth quadratic attenuation: intensity ~ 1 / (1 + (d/r)^2)
     // replace your attenuation line inside PointLight():
-    float r = max(uFireballRadius, 1e-3);
+    float r = max(fireballRadius, 1e-3);
     float att = 1.0 / (1.0 + pow(d / r, 4.0));  // much tighter than quadratic
 
     return lc * ndotl * att;
@@ -80,7 +118,18 @@ vec3 PointLight(vec3 lp, vec3 lc, vec3 fragPos, vec3 N)
 
 void main()
 {
-    vec3 base = texture(texture_diffuse1, fs_in.Tex).rgb;
+    Material material = materials[uMaterial];
+    vec3 uvw = vec3(fs_in.Tex, float(material.layer.x));
+    vec3 base;
+    if (material.layer.y > 0) {
+        // finer mips still streaming in: clamp to the finest resident one
+        vec2 texel = fs_in.Tex * vec2(textureSize(materialTextures, 0).xy);
+        float lod = 0.5 * log2(max(dot(dFdx(texel), dFdx(texel)), dot(dFdy(texel), dFdy(texel))));
+        base = textureLod(materialTextures, uvw, max(lod, float(material.layer.y))).rgb;
+    } else {
+        base = texture(materialTextures, uvw).rgb;
+    }
+    base *= material.baseColor.rgb;
 
     // world-space normal
     vec3 N = normalize(fs_in.Normal);
@@ -91,22 +140,35 @@ void main()
     float sunDiff = max(dot(N, sunDir), 0.0);
 
     // shadows for sun only
+#if PCF_TAPS > 0
     float shadow = ShadowFactor(fs_in.FragPosLightSpace, N, sunDir);
-    vec3 sunLight = lightColor * sunDiff * (1.0 - shadow);
+#else
+    float shadow = 0.0;
+#endif
+    vec3 sunLight = lightColor.rgb * sunDiff * (1.0 - shadow);
 
     // ---------- FIREBALL POINT LIGHTS ----------
     vec3 fireballLight = vec3(0.0);
-    for (int i = 0; i < uFireballCount; ++i) {
-        fireballLight += PointLight(uFireballPos[i], uFireballColor[i], fs_in.FragPos, N);
+#if MAX_LIGHTS > 0
+    int lightCount = min(fireballCount, MAX_LIGHTS);
+    for (int i = 0; i < lightCount; ++i) {
+        fireballLight += PointLight(fireballs[i].position.xyz, fireballs[i].color.rgb, fs_in.FragPos, N);
     }
+#endif
 
     // ---------- HIT FLASH overlay ----------
-    vec3 hitFlash = mix(vec3(0.0), hitFlashColor, clamp(hitFlashStrength, 0.0, 1.0));
-
-    // ---------- emissive for the fireball mesh itself ----------
-    vec3 emissive = (isFireball > 0.5)
-        ? vec3(1.0, 0.45, 0.15) * 2.0    // bright orange core
-        : vec3(0.0);
+#if HIT_FLASH
+    vec3 hitFlash = material.hitFlash.rgb * clamp(material.hitFlash.a, 0.0, 1.0);
+#else
+    vec3 hitFlash = vec3(0.0);
+#endif
+
+    // ---------- emissive (fireball core, glowing staff) ----------
+#if EMISSIVE
+    vec3 emissive = material.emissive.rgb;
+#else
+    vec3 emissive = vec3(0.0);
+#endif
 
     // ---------- assemble ----------
     vec3 lighting = sunLight + fireballLight;
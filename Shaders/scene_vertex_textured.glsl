@@ -1,13 +1,34 @@
 #version 330 core
 
-layout (location = 0) in vec3 aPos;      // position (world model space)
-layout (location = 1) in vec3 aNormal;   // normal  (model space)
+layout (location = 0) in vec3 aPos;      // position (model space; [0,1] AABB-relative for quantized meshes)
+layout (location = 1) in vec3 aNormal;   // normal  (model space; .xy = octahedral encoding when uOctNormals)
 layout (location = 2) in vec2 aTex;      // uv
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix; // for shadowing from the sun
+// INSTANCED variants (ShaderPermutations.h) take the matrices per instance
+// (InstanceData in Assignment2.cpp), the others per draw
+#ifndef INSTANCED
+#define INSTANCED 0
+#endif
+#if INSTANCED
+layout (location = 3) in mat4 aInstanceModel;        // locations 3-6
+layout (location = 7) in mat3 aInstanceNormalMatrix; // locations 7-9
+#else
+uniform mat4 model;            // includes the mesh dequantization for quantized meshes
+uniform mat3 normalMatrix;     // inverse-transpose of the object's model matrix (no dequantization)
+#endif
+uniform bool uOctNormals;      // normals arrive as 2x16-bit snorm octahedral
+
+// ---------- per-frame constants (FrameData in Assignment2.cpp) ----------
+layout(std140) uniform FrameBlock {
+    mat4  view;
+    mat4  projection;
+    mat4  lightSpaceMatrix; // sun shadow map
+    vec3  viewPos;
+    float time;             // seconds since startup
+    vec3  lightPos;         // sun, animated around the origin
+    float deltaTime;
+    vec4  lightColor;       // rgb
+};
 
 out VS_OUT {
     vec3 FragPos;               // world-space position
@@ -16,14 +37,27 @@ out VS_OUT {
     vec4 FragPosLightSpace;     // for shadow map lookup
 } vs_out;
 
+// inverse of octEncode() in VertexQuantization.h
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main()
 {
+#if INSTANCED
+    mat4 model = aInstanceModel;
+    mat3 normalMatrix = aInstanceNormalMatrix;
+#endif
     vec4 worldPos = model * vec4(aPos, 1.0);
     vs_out.FragPos = worldPos.xyz;
 
-    // correct normal transform (assumes no non-uniform scale; if you have, add normalMatrix)
-    mat3 normalMatrix = mat3(transpose(inverse(model)));
-    vs_out.Normal = normalize(normalMatrix * aNormal);
+    vec3 normal = uOctNormals ? octDecode(aNormal.xy) : aNormal;
+    vs_out.Normal = normalize(normalMatrix * normal);
 
     vs_out.Tex = aTex;
     vs_out.FragPosLightSpace = lightSpaceMatrix * worldPos;
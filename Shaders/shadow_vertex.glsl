@@ -1,11 +1,37 @@
 #version 330 core
 
+// Quantized meshes feed 16-bit unorm positions ([0,1] inside the mesh AABB);
+// the attribute fetch normalizes them and the dequantization is folded into
+// model, so float and quantized meshes share this path.
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMatrix;
+// ---------- per-frame constants (FrameData in Assignment2.cpp) ----------
+layout(std140) uniform FrameBlock {
+    mat4  view;
+    mat4  projection;
+    mat4  lightSpaceMatrix; // sun shadow map
+    vec3  viewPos;
+    float time;             // seconds since startup
+    vec3  lightPos;         // sun, animated around the origin
+    float deltaTime;
+    vec4  lightColor;       // rgb
+};
+
+// built a second time with INSTANCED 1 for instanced draws, which take the
+// model matrix per instance (InstanceData in Assignment2.cpp)
+#ifndef INSTANCED
+#define INSTANCED 0
+#endif
+#if INSTANCED
+layout (location = 3) in mat4 aInstanceModel; // locations 3-6
+#else
 uniform mat4 model;
+#endif
 
 void main()
 {
+#if INSTANCED
+    mat4 model = aInstanceModel;
+#endif
     gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
 }
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "MipChain.h"
+#include "TextureCompression.h"
+
+// Texture cache in KTX 1.1 format: the KTX header, one key/value pair
+// recording the XXH64 of the source image, the cache version and the build
+// flags (mip filter), then every mip level as `uint32 imageSize` followed by
+// the blocks or pixels. Levels are block-compressed, or plain RGBA8 when the
+// GPU cannot sample a compressed format. A warm load maps the file and passes
+// each level straight to glCompressedTexImage2D / glTexImage2D; no decode, no
+// glGenerateMipmap. Standard KTX tools can open the files, which helps when
+// checking encoder quality.
+
+const uint8_t KTX_IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+const uint32_t TEXTURE_CACHE_VERSION = 2; // 2: gamma-correct CPU mips, RGBA8 levels, build flags
+const uint32_t TEXTURE_CACHE_MAX_LEVELS = 16;
+const char TEXTURE_CACHE_KEY[] = "WZ.source"; // value: uint64 source hash, uint32 version, uint32 flags
+const uint32_t TEXTURE_CACHE_RGBA8 = 0x8058;   // GL_RGBA8: uncompressed levels
+
+struct KtxHeader
+{
+    uint8_t identifier[12];
+    uint32_t endianness;
+    uint32_t glType; // 0 for compressed formats
+    uint32_t glTypeSize;
+    uint32_t glFormat; // 0 for compressed formats
+    uint32_t glInternalFormat; // TextureBlockFormat or TEXTURE_CACHE_RGBA8
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+static_assert(sizeof(KtxHeader) == 64, "KTX header is 64 bytes");
+
+// Mip levels of a validated cache image, finest first.
+struct TextureCacheView
+{
+    const KtxHeader *header = nullptr;
+    uint32_t levelCount = 0;
+    const char *levels[TEXTURE_CACHE_MAX_LEVELS];
+    uint32_t levelBytes[TEXTURE_CACHE_MAX_LEVELS];
+
+    size_t totalBytes() const
+    {
+        size_t bytes = 0;
+        for (uint32_t i = 0; i < levelCount; i++)
+            bytes += levelBytes[i];
+        return bytes;
+    }
+};
+
+inline std::string textureCachePath(const char *sourcePath)
+{
+    return std::string(sourcePath) + ".ktx";
+}
+
+inline size_t textureCacheLevelBytes(uint32_t format, uint32_t width, uint32_t height)
+{
+    return format == TEXTURE_CACHE_RGBA8 ? (size_t)width * height * 4 : compressedLevelBytes(format, width, height);
+}
+
+inline uint32_t readU32(const char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+// Fills view if [data, data + size) is a complete KTX cache of the current
+// version built from a source with the given hash and flags. Returns false
+// otherwise.
+inline bool validateTextureCache(const char *data, size_t size, uint64_t sourceHash, uint32_t flags, TextureCacheView &view)
+{
+    view.header = nullptr;
+    if (!data || size < sizeof(KtxHeader))
+        return false;
+    const KtxHeader *header = (const KtxHeader *)data;
+    if (memcmp(header->identifier, KTX_IDENTIFIER, 12) != 0 || header->endianness != KTX_ENDIANNESS)
+        return false;
+    if (header->glInternalFormat == TEXTURE_CACHE_RGBA8)
+    {
+        if (header->glType != 0x1401 || header->glFormat != 0x1908) // GL_UNSIGNED_BYTE, GL_RGBA
+            return false;
+    }
+    else if (header->glType != 0 || header->glFormat != 0 || !isTextureBlockFormat(header->glInternalFormat))
+        return false;
+    if (header->pixelWidth == 0 || header->pixelHeight == 0 || header->pixelDepth != 0 || header->numberOfArrayElements != 0 || header->numberOfFaces != 1)
+        return false;
+    uint32_t levelCount = header->numberOfMipmapLevels;
+    if (levelCount == 0 || levelCount > TEXTURE_CACHE_MAX_LEVELS || levelCount > mipLevelCount(header->pixelWidth, header->pixelHeight))
+        return false;
+
+    // Our key/value pair comes first
+    const size_t keyLength = sizeof(TEXTURE_CACHE_KEY); // with the NUL
+    size_t offset = sizeof(KtxHeader);
+    if (header->bytesOfKeyValueData < 4 + keyLength + 16 || header->bytesOfKeyValueData > size - offset)
+        return false;
+    if (readU32(data + offset) != keyLength + 16 || memcmp(data + offset + 4, TEXTURE_CACHE_KEY, keyLength) != 0)
+        return false;
+    uint64_t storedHash;
+    memcpy(&storedHash, data + offset + 4 + keyLength, 8);
+    if (storedHash != sourceHash || readU32(data + offset + 4 + keyLength + 8) != TEXTURE_CACHE_VERSION)
+        return false;
+    if (readU32(data + offset + 4 + keyLength + 12) != flags)
+        return false;
+    offset += header->bytesOfKeyValueData;
+
+    uint32_t width = header->pixelWidth, height = header->pixelHeight;
+    for (uint32_t i = 0; i < levelCount; i++)
+    {
+        if (offset + 4 > size)
+            return false;
+        uint32_t bytes = readU32(data + offset);
+        if (bytes != textureCacheLevelBytes(header->glInternalFormat, width, height) || offset + 4 + bytes > size)
+            return false;
+        view.levels[i] = data + offset + 4;
+        view.levelBytes[i] = bytes;
+        offset += 4 + ((bytes + 3) & ~3u);
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    view.levelCount = levelCount;
+    view.header = header;
+    return true;
+}
+
+// Builds the full mip chain of an RGBA8 image with mipFilter and stores it in
+// format, compressed or TEXTURE_CACHE_RGBA8. The cache flags record mipFilter
+// | extraFlags (anything else the caller did to the image, such as a resize).
+inline void buildTextureCache(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t format, MipFilter mipFilter,
+                              uint64_t sourceHash, std::vector<char> &image, uint32_t extraFlags = 0)
+{
+    KtxHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, KTX_IDENTIFIER, 12);
+    header.endianness = KTX_ENDIANNESS;
+    header.glTypeSize = 1;
+    if (format == TEXTURE_CACHE_RGBA8)
+    {
+        header.glType = 0x1401;   // GL_UNSIGNED_BYTE
+        header.glFormat = 0x1908; // GL_RGBA
+    }
+    header.glInternalFormat = format;
+    header.glBaseInternalFormat = format == TEXTURE_BC1 ? 0x1907 : 0x1908; // GL_RGB / GL_RGBA
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = std::min(mipLevelCount(width, height), TEXTURE_CACHE_MAX_LEVELS);
+
+    const uint32_t keyLength = sizeof(TEXTURE_CACHE_KEY);
+    const uint32_t pairBytes = keyLength + 16;
+    const uint32_t flags = mipFilter | extraFlags;
+    header.bytesOfKeyValueData = (4 + pairBytes + 3) & ~3u;
+
+    size_t total = sizeof(KtxHeader) + header.bytesOfKeyValueData;
+    for (uint32_t i = 0, w = width, h = height; i < header.numberOfMipmapLevels; i++, w = std::max(1u, w / 2), h = std::max(1u, h / 2))
+        total += 4 + ((textureCacheLevelBytes(format, w, h) + 3) & ~(size_t)3);
+    image.assign(total, 0);
+
+    char *p = image.data();
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, &pairBytes, 4);
+    memcpy(p + 4, TEXTURE_CACHE_KEY, keyLength);
+    memcpy(p + 4 + keyLength, &sourceHash, 8);
+    memcpy(p + 4 + keyLength + 8, &TEXTURE_CACHE_VERSION, 4);
+    memcpy(p + 4 + keyLength + 12, &flags, 4);
+    p += header.bytesOfKeyValueData;
+
+    std::vector<std::vector<uint8_t>> mips;
+    generateMipChain(rgba, width, height, mipFilter, header.numberOfMipmapLevels, mips);
+    uint32_t w = width, h = height;
+    for (uint32_t i = 0; i < header.numberOfMipmapLevels; i++)
+    {
+        const uint8_t *level = i == 0 ? rgba : mips[i - 1].data();
+        uint32_t bytes = (uint32_t)textureCacheLevelBytes(format, w, h);
+        memcpy(p, &bytes, 4);
+        if (format == TEXTURE_CACHE_RGBA8)
+            memcpy(p + 4, level, bytes);
+        else
+            compressImage(level, w, h, format, (uint8_t *)p + 4);
+        p += 4 + ((bytes + 3) & ~3u);
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+}
+
+// A cache file mapped for reading. view.header is null unless the file is a
+// valid cache for the given source hash and flags.
+struct TextureCacheFile
+{
+    MappedFile file;
+    TextureCacheView view;
+
+    bool open(const char *path, uint64_t sourceHash, uint32_t flags)
+    {
+        view.header = nullptr;
+        if (!file.open(path))
+            return false;
+        if (!validateTextureCache(file.data(), file.size(), sourceHash, flags, view))
+            file.close();
+        return view.header != nullptr;
+    }
+};
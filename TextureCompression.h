@@ -0,0 +1,479 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_COMPRESSION_SSE2 1
+#endif
+
+// CPU block compression of RGBA8 images into the S3TC/BPTC formats GPUs
+// sample directly:
+//  - BC1: 4 bits per pixel, opaque RGB.
+//  - BC3: 8 bits per pixel, BC1 colour plus a separately interpolated alpha.
+//  - BC7: 8 bits per pixel, mode 6 only (one RGBA endpoint pair with 16
+//    interpolation steps), which already beats BC3 on smooth alpha.
+// Each 4x4 block gets endpoints from the principal axis of its colours and
+// one least-squares refit; picking each pixel's palette index is the hot
+// loop and runs on SSE2 when available. Rows of blocks are spread over
+// threads.
+
+// Block formats, numerically equal to the matching GL enums so they can be
+// passed to glCompressedTexImage2D as-is.
+enum TextureBlockFormat : uint32_t
+{
+    TEXTURE_BC1 = 0x83F0, // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    TEXTURE_BC3 = 0x83F3, // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    TEXTURE_BC7 = 0x8E8C, // GL_COMPRESSED_RGBA_BPTC_UNORM
+};
+
+inline bool isTextureBlockFormat(uint32_t format)
+{
+    return format == TEXTURE_BC1 || format == TEXTURE_BC3 || format == TEXTURE_BC7;
+}
+
+inline uint32_t textureBlockBytes(uint32_t format)
+{
+    return format == TEXTURE_BC1 ? 8 : 16;
+}
+
+inline size_t compressedLevelBytes(uint32_t format, uint32_t width, uint32_t height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * textureBlockBytes(format);
+}
+
+// Levels in a full mip chain down to 1x1.
+inline uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+// True if any pixel of an RGBA8 image is not fully opaque.
+inline bool imageHasAlpha(const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    for (size_t i = 0, n = (size_t)width * height; i < n; i++)
+        if (rgba[i * 4 + 3] != 255)
+            return true;
+    return false;
+}
+
+// Expands 1-4 channel 8-bit pixels to RGBA8 (grey replicated, alpha 255).
+inline void expandToRGBA(const uint8_t *pixels, uint32_t width, uint32_t height, int channels, std::vector<uint8_t> &rgba)
+{
+    size_t count = (size_t)width * height;
+    rgba.resize(count * 4);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *p = pixels + i * channels;
+        uint8_t *q = &rgba[i * 4];
+        q[0] = p[0];
+        q[1] = channels >= 3 ? p[1] : p[0];
+        q[2] = channels >= 3 ? p[2] : p[0];
+        q[3] = channels == 4 ? p[3] : (channels == 2 ? p[1] : 255);
+    }
+}
+
+namespace texture_compression_detail
+{
+    // One 4x4 block, channel-major so four pixels fill one SSE register.
+    struct Block
+    {
+        alignas(16) float c[4][16];
+    };
+
+    inline void loadBlock(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, Block &block)
+    {
+        for (uint32_t y = 0; y < 4; y++)
+        {
+            const uint8_t *row = rgba + (size_t)std::min(by * 4 + y, height - 1) * width * 4;
+            for (uint32_t x = 0; x < 4; x++)
+            {
+                const uint8_t *p = row + std::min(bx * 4 + x, width - 1) * 4;
+                for (int c = 0; c < 4; c++)
+                    block.c[c][y * 4 + x] = p[c];
+            }
+        }
+    }
+
+    // Index of each pixel's nearest point among `levels` evenly spaced steps
+    // from e0 to e1, by projecting onto the segment over the first
+    // `channels` channels.
+    inline void projectIndices(const Block &block, const float e0[4], const float e1[4], int channels, int levels, uint8_t indices[16])
+    {
+        float d[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float lengthSq = 0.0f;
+        for (int c = 0; c < channels; c++)
+        {
+            d[c] = e1[c] - e0[c];
+            lengthSq += d[c] * d[c];
+        }
+        if (lengthSq < 1e-6f)
+        {
+            memset(indices, 0, 16);
+            return;
+        }
+        float scale = (levels - 1) / lengthSq;
+        for (int c = 0; c < channels; c++)
+            d[c] *= scale;
+#ifdef TEXTURE_COMPRESSION_SSE2
+        const __m128 maxIndex = _mm_set1_ps((float)(levels - 1));
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 t = _mm_set1_ps(0.5f);
+            for (int c = 0; c < channels; c++)
+            {
+                __m128 p = _mm_sub_ps(_mm_load_ps(&block.c[c][i]), _mm_set1_ps(e0[c]));
+                t = _mm_add_ps(t, _mm_mul_ps(p, _mm_set1_ps(d[c])));
+            }
+            t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), maxIndex);
+            __m128i index = _mm_cvttps_epi32(t);
+            index = _mm_packs_epi32(index, index);
+            index = _mm_packus_epi16(index, index);
+            uint32_t packed = (uint32_t)_mm_cvtsi128_si32(index);
+            memcpy(indices + i, &packed, 4);
+        }
+#else
+        for (int i = 0; i < 16; i++)
+        {
+            float t = 0.5f;
+            for (int c = 0; c < channels; c++)
+                t += (block.c[c][i] - e0[c]) * d[c];
+            indices[i] = (uint8_t)std::min(std::max(t, 0.0f), (float)(levels - 1));
+        }
+#endif
+    }
+
+    // Squared error of the block against the evenly spaced palette e0..e1.
+    inline float paletteError(const Block &block, const float e0[4], const float e1[4], int channels, int levels, const uint8_t indices[16])
+    {
+        float error = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float w = (float)indices[i] / (levels - 1);
+            for (int c = 0; c < channels; c++)
+            {
+                float diff = e0[c] + (e1[c] - e0[c]) * w - block.c[c][i];
+                error += diff * diff;
+            }
+        }
+        return error;
+    }
+
+    // Endpoints at the extremes of the block along its principal axis.
+    inline void fitEndpoints(const Block &block, int channels, float e0[4], float e1[4])
+    {
+        float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int c = 0; c < channels; c++)
+        {
+            for (int i = 0; i < 16; i++)
+                mean[c] += block.c[c][i];
+            mean[c] /= 16.0f;
+        }
+        float cov[4][4] = {};
+        for (int i = 0; i < 16; i++)
+            for (int a = 0; a < channels; a++)
+                for (int b = a; b < channels; b++)
+                    cov[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < a; b++)
+                cov[a][b] = cov[b][a];
+
+        // Power iteration converges on the dominant eigenvector in a few steps
+        float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            float length = 0.0f;
+            for (int a = 0; a < channels; a++)
+            {
+                for (int b = 0; b < channels; b++)
+                    next[a] += cov[a][b] * axis[b];
+                length = std::max(length, fabsf(next[a]));
+            }
+            if (length < 1e-6f)
+                break;
+            for (int a = 0; a < channels; a++)
+                axis[a] = next[a] / length;
+        }
+
+        float lo = 1e30f, hi = -1e30f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < channels; c++)
+                t += (block.c[c][i] - mean[c]) * axis[c];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t);
+        }
+        float lengthSq = 0.0f;
+        for (int c = 0; c < channels; c++)
+            lengthSq += axis[c] * axis[c];
+        lo /= std::max(lengthSq, 1e-6f);
+        hi /= std::max(lengthSq, 1e-6f);
+        for (int c = 0; c < channels; c++)
+        {
+            e0[c] = std::min(std::max(mean[c] + axis[c] * lo, 0.0f), 255.0f);
+            e1[c] = std::min(std::max(mean[c] + axis[c] * hi, 0.0f), 255.0f);
+        }
+    }
+
+    // Least-squares endpoints for fixed indices. Leaves e0/e1 alone when all
+    // pixels share one index.
+    inline void refitEndpoints(const Block &block, int channels, const uint8_t indices[16], int levels, float e0[4], float e1[4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ap[4] = {0.0f, 0.0f, 0.0f, 0.0f}, bp[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++)
+        {
+            float w = (float)indices[i] / (levels - 1);
+            float a = 1.0f - w;
+            aa += a * a;
+            ab += a * w;
+            bb += w * w;
+            for (int c = 0; c < channels; c++)
+            {
+                ap[c] += a * block.c[c][i];
+                bp[c] += w * block.c[c][i];
+            }
+        }
+        float det = aa * bb - ab * ab;
+        if (fabsf(det) < 1e-6f)
+            return;
+        for (int c = 0; c < channels; c++)
+        {
+            e0[c] = std::min(std::max((ap[c] * bb - bp[c] * ab) / det, 0.0f), 255.0f);
+            e1[c] = std::min(std::max((bp[c] * aa - ap[c] * ab) / det, 0.0f), 255.0f);
+        }
+    }
+
+    inline uint16_t packColor565(const float color[4])
+    {
+        uint32_t r = (uint32_t)(color[0] * 31.0f / 255.0f + 0.5f);
+        uint32_t g = (uint32_t)(color[1] * 63.0f / 255.0f + 0.5f);
+        uint32_t b = (uint32_t)(color[2] * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpackColor565(uint16_t packed, float color[4])
+    {
+        uint32_t r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (float)((r << 3) | (r >> 2));
+        color[1] = (float)((g << 2) | (g >> 4));
+        color[2] = (float)((b << 3) | (b >> 2));
+        color[3] = 255.0f;
+    }
+
+    // BC1 colour block in four-colour mode (colour0 > colour1), which is
+    // also the only mode of the colour half of BC3.
+    inline void encodeColorBlock(const Block &block, uint8_t out[8])
+    {
+        float e0[4], e1[4], q0[4], q1[4];
+        uint8_t indices[16], best[16];
+        uint16_t c0 = 0, c1 = 0;
+        float bestError = 1e30f;
+        fitEndpoints(block, 3, e0, e1);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            uint16_t p0 = packColor565(e0), p1 = packColor565(e1);
+            unpackColor565(p0, q0);
+            unpackColor565(p1, q1);
+            projectIndices(block, q0, q1, 3, 4, indices);
+            float error = paletteError(block, q0, q1, 3, 4, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                c0 = p0;
+                c1 = p1;
+                memcpy(best, indices, 16);
+            }
+            refitEndpoints(block, 3, indices, 4, e0, e1);
+        }
+
+        // Steps 0..3 from c0 to c1 are codes 0, 2, 3, 1
+        static const uint8_t code[4] = {0, 2, 3, 1};
+        bool swap = c0 < c1;
+        if (swap)
+            std::swap(c0, c1);
+        uint32_t bits = 0;
+        if (c0 != c1)
+            for (int i = 0; i < 16; i++)
+                bits |= (uint32_t)code[swap ? 3 - best[i] : best[i]] << (2 * i);
+        memcpy(out, &c0, 2);
+        memcpy(out + 2, &c1, 2);
+        memcpy(out + 4, &bits, 4);
+    }
+
+    // BC3 alpha block in eight-value mode (alpha0 > alpha1).
+    inline void encodeAlphaBlock(const Block &block, uint8_t out[8])
+    {
+        float lo = 255.0f, hi = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            lo = std::min(lo, block.c[3][i]);
+            hi = std::max(hi, block.c[3][i]);
+        }
+        uint8_t a0 = (uint8_t)(hi + 0.5f), a1 = (uint8_t)(lo + 0.5f);
+        Block alpha;
+        memcpy(alpha.c[0], block.c[3], sizeof(alpha.c[0]));
+        float e0[4] = {(float)a0}, e1[4] = {(float)a1};
+        uint8_t indices[16];
+        projectIndices(alpha, e0, e1, 1, 8, indices);
+
+        // Steps 0..7 from alpha0 to alpha1 are codes 0, 2, 3, ..., 7, 1
+        static const uint8_t code[8] = {0, 2, 3, 4, 5, 6, 7, 1};
+        uint64_t bits = 0;
+        if (a0 != a1)
+            for (int i = 0; i < 16; i++)
+                bits |= (uint64_t)code[indices[i]] << (3 * i);
+        out[0] = a0;
+        out[1] = a1;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (uint8_t)(bits >> (8 * i));
+    }
+
+    // Appends bit fields to a 128-bit block, least significant bit first.
+    struct BitWriter
+    {
+        uint8_t *out;
+        uint32_t position = 0;
+
+        void write(uint32_t value, uint32_t bits)
+        {
+            for (uint32_t i = 0; i < bits; i++, position++)
+                if (value >> i & 1)
+                    out[position >> 3] |= (uint8_t)(1u << (position & 7));
+        }
+    };
+
+    // Rounds an RGBA endpoint to 7 bits per channel plus a shared low bit,
+    // trying both values of the bit.
+    inline void quantizeEndpoint7P(const float endpoint[4], uint32_t channels[4], uint32_t &pbit, float decoded[4])
+    {
+        float bestError = 1e30f;
+        for (uint32_t p = 0; p < 2; p++)
+        {
+            uint32_t q[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++)
+            {
+                float v = (endpoint[c] - p) * 0.5f;
+                q[c] = (uint32_t)std::min(std::max(v + 0.5f, 0.0f), 127.0f);
+                float diff = (float)(q[c] * 2 + p) - endpoint[c];
+                error += diff * diff;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pbit = p;
+                for (int c = 0; c < 4; c++)
+                {
+                    channels[c] = q[c];
+                    decoded[c] = (float)(q[c] * 2 + p);
+                }
+            }
+        }
+    }
+
+    // BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints with a low bit each,
+    // 4-bit indices. Mode 6 weights (0, 4, 9, ..., 64)/64 are within half a
+    // step of even spacing, so the even-spacing projection picks them.
+    inline void encodeBC7Block(const Block &block, uint8_t out[16])
+    {
+        float e0[4], e1[4];
+        uint32_t q[2][4], p[2];
+        float d0[4], d1[4];
+        uint8_t indices[16], best[16];
+        uint32_t bestQ[2][4] = {}, bestP[2] = {};
+        float bestError = 1e30f;
+        fitEndpoints(block, 4, e0, e1);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            quantizeEndpoint7P(e0, q[0], p[0], d0);
+            quantizeEndpoint7P(e1, q[1], p[1], d1);
+            projectIndices(block, d0, d1, 4, 16, indices);
+            float error = paletteError(block, d0, d1, 4, 16, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                memcpy(bestQ, q, sizeof(q));
+                memcpy(bestP, p, sizeof(p));
+                memcpy(best, indices, 16);
+            }
+            refitEndpoints(block, 4, indices, 16, e0, e1);
+        }
+
+        // The first index is stored with its top bit implied zero
+        bool swap = best[0] >= 8;
+        int first = swap ? 1 : 0, second = swap ? 0 : 1;
+        memset(out, 0, 16);
+        BitWriter writer{out};
+        writer.write(1u << 6, 7);
+        for (int c = 0; c < 4; c++)
+        {
+            writer.write(bestQ[first][c], 7);
+            writer.write(bestQ[second][c], 7);
+        }
+        writer.write(bestP[first], 1);
+        writer.write(bestP[second], 1);
+        for (int i = 0; i < 16; i++)
+            writer.write(swap ? 15 - best[i] : best[i], i == 0 ? 3 : 4);
+    }
+
+    inline void encodeBlock(const Block &block, uint32_t format, uint8_t *out)
+    {
+        if (format == TEXTURE_BC1)
+            encodeColorBlock(block, out);
+        else if (format == TEXTURE_BC3)
+        {
+            encodeAlphaBlock(block, out);
+            encodeColorBlock(block, out + 8);
+        }
+        else
+            encodeBC7Block(block, out);
+    }
+} // namespace texture_compression_detail
+
+// Compresses one RGBA8 level into compressedLevelBytes(format, width, height)
+// bytes at out. Block rows are shared out to up to threadCount threads (0:
+// one per hardware thread).
+inline void compressImage(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t format, uint8_t *out, unsigned threadCount = 0)
+{
+    using namespace texture_compression_detail;
+    const uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    const size_t rowBytes = (size_t)blocksX * textureBlockBytes(format);
+    std::atomic<uint32_t> nextRow{0};
+    auto encodeRows = [&]()
+    {
+        Block block;
+        for (uint32_t by; (by = nextRow.fetch_add(1)) < blocksY;)
+            for (uint32_t bx = 0; bx < blocksX; bx++)
+            {
+                loadBlock(rgba, width, height, bx, by, block);
+                encodeBlock(block, format, out + by * rowBytes + (size_t)bx * textureBlockBytes(format));
+            }
+    };
+
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, (blocksY + 7) / 8); // a thread per 8+ rows
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threadCount; i++)
+        workers.emplace_back(encodeRows);
+    encodeRows();
+    for (std::thread &worker : workers)
+        worker.join();
+}
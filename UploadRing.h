@@ -0,0 +1,277 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Staging ring for GPU uploads. Data is written into one large buffer object
+// and the GL thread only issues the copies out of it (glTexSubImage* with the
+// ring bound as GL_PIXEL_UNPACK_BUFFER, glCopyBufferSubData), which return
+// without waiting for the transfer. Space is handed out in order and comes
+// back once a fence inserted after the copies that read it has signalled.
+//
+// With ARB_buffer_storage the buffer is persistently mapped and coherent, so
+// any thread may reserve() space and fill it; the GL thread just issues the
+// copy. Without it (plain GL 3.3) only the GL thread can write, through
+// stage(): unsynchronized map of the range, orphaning the buffer whenever the
+// ring wraps so the driver keeps the old storage alive for copies in flight.
+//
+// Positions are virtual byte counts that only grow; the physical offset is
+// position % capacity, and tail..head is what is reserved or still being read.
+
+// A range of the ring: write size bytes at data (persistent rings), then pass
+// offset to the copy reading it.
+struct UploadSpan
+{
+    void *data = nullptr;
+    size_t offset = 0;
+    size_t size = 0;
+    uint64_t position = 0;
+};
+
+struct UploadRingStats
+{
+    size_t bytesInFlight = 0;     // reserved or not yet retired
+    size_t peakBytesInFlight = 0;
+    size_t bytesStaged = 0;
+    size_t fenceWaits = 0;        // times the GL thread blocked on a fence for space
+    double fenceWaitMs = 0.0;
+    size_t stalls = 0;            // uploads that bypassed the ring (no space, or larger than it)
+};
+
+class UploadRing
+{
+public:
+    static const size_t ALIGNMENT = 16;
+
+    UploadRing() = default;
+    ~UploadRing() { destroy(); }
+
+    UploadRing(const UploadRing &) = delete;
+    UploadRing &operator=(const UploadRing &) = delete;
+
+    // GL thread. Persistent mapping needs ARB_buffer_storage; pass false to
+    // use orphaning instead.
+    bool create(size_t capacity, bool persistent)
+    {
+        destroy();
+        mCapacity = capacity;
+        glGenBuffers(1, &mBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+        if (persistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, nullptr, flags);
+            mMapped = (uint8_t *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags);
+        }
+        else
+            glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return !persistent || mMapped;
+    }
+
+    // GL thread.
+    void destroy()
+    {
+        if (!mBuffer)
+            return;
+        for (const Fence &fence : mFences)
+            glDeleteSync(fence.sync);
+        mFences.clear();
+        mReserved.clear();
+        if (mMapped)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            mMapped = nullptr;
+        }
+        glDeleteBuffers(1, &mBuffer);
+        mBuffer = 0;
+        mHead = mTail = 0;
+    }
+
+    GLuint buffer() const { return mBuffer; }
+    bool persistent() const { return mMapped != nullptr; }
+
+    // Any thread, persistent rings only: reserves size bytes for the caller
+    // to fill. Never waits; fails if the space is still in flight (the caller
+    // uploads some other way or tries again later).
+    bool reserve(size_t size, UploadSpan &span)
+    {
+        if (!mMapped)
+            return false;
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!allocate(size, span))
+            return false;
+        mStats.bytesStaged += size;
+        return true;
+    }
+
+    // GL thread: copies size bytes into the ring, waiting on fences for space
+    // if needed. Fails (counted as a stall) if the ring is smaller than size
+    // or held by reservations not yet issued.
+    bool stage(const void *data, size_t size, UploadSpan &span)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (!allocate(size, span))
+        {
+            if (size > mCapacity || mFences.empty() || !mMapped)
+            {
+                mStats.stalls++;
+                return false;
+            }
+            // Wait for the oldest batch of copies to finish reading
+            auto start = std::chrono::steady_clock::now();
+            glClientWaitSync(mFences.front().sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            mStats.fenceWaits++;
+            mStats.fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            retireLocked();
+        }
+        if (mMapped)
+            memcpy(span.data, data, size);
+        else
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+            if (span.offset == 0)
+                glBufferData(GL_COPY_WRITE_BUFFER, mCapacity, nullptr, GL_STREAM_COPY); // orphan on wrap
+            void *target = glMapBufferRange(GL_COPY_WRITE_BUFFER, span.offset, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            if (target)
+            {
+                memcpy(target, data, size);
+                glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            if (!target)
+            {
+                issuedLocked(span);
+                mStats.stalls++;
+                return false;
+            }
+        }
+        mStats.bytesStaged += size;
+        return true;
+    }
+
+    // GL thread: the copy reading span has been issued (or span is no longer
+    // needed); its space retires with the next fence.
+    void issued(const UploadSpan &span)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        issuedLocked(span);
+    }
+
+    // GL thread: fences the copies issued so far. Call once per frame.
+    void fence()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint64_t end = popIssued();
+        if (end != 0)
+            mFences.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), end});
+    }
+
+    // GL thread: frees the space of copies the GPU has finished.
+    void retire()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        retireLocked();
+    }
+
+    UploadRingStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        UploadRingStats stats = mStats;
+        stats.bytesInFlight = (size_t)(mHead - mTail);
+        return stats;
+    }
+
+private:
+    struct Range
+    {
+        uint64_t begin, end;
+        bool issued;
+    };
+    struct Fence
+    {
+        GLsync sync;
+        uint64_t end;
+    };
+
+    bool allocate(size_t size, UploadSpan &span)
+    {
+        if (size == 0 || size > mCapacity)
+            return false;
+        uint64_t begin = (mHead + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+        if (begin % mCapacity + size > mCapacity)
+            begin += mCapacity - begin % mCapacity; // skip the end, start the next lap
+        if (begin + size - mTail > mCapacity)
+            return false;
+        mHead = begin + size;
+        mReserved.push_back({begin, mHead, false});
+        span.offset = (size_t)(begin % mCapacity);
+        span.data = mMapped ? mMapped + span.offset : nullptr;
+        span.size = size;
+        span.position = begin;
+        mStats.peakBytesInFlight = std::max(mStats.peakBytesInFlight, (size_t)(mHead - mTail));
+        return true;
+    }
+
+    void issuedLocked(const UploadSpan &span)
+    {
+        for (Range &range : mReserved)
+            if (range.begin == span.position)
+            {
+                range.issued = true;
+                break;
+            }
+        if (!mMapped)
+        {
+            // orphaning on wrap already keeps storage alive for copies in
+            // flight, so issued space is free at once
+            popIssued();
+            mTail = mReserved.empty() ? mHead : mReserved.front().begin;
+        }
+    }
+
+    // Drops the issued ranges at the front; returns where the last one ended
+    // (0 if none).
+    uint64_t popIssued()
+    {
+        uint64_t end = 0;
+        while (!mReserved.empty() && mReserved.front().issued)
+        {
+            end = mReserved.front().end;
+            mReserved.pop_front();
+        }
+        return end;
+    }
+
+    void retireLocked()
+    {
+        while (!mFences.empty())
+        {
+            GLenum result = glClientWaitSync(mFences.front().sync, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(mFences.front().sync);
+            mTail = mFences.front().end;
+            mFences.pop_front();
+        }
+    }
+
+    mutable std::mutex mMutex;
+    GLuint mBuffer = 0;
+    uint8_t *mMapped = nullptr;
+    size_t mCapacity = 0;
+    uint64_t mHead = 0, mTail = 0;
+    std::deque<Range> mReserved; // in ring order; not yet covered by a fence
+    std::deque<Fence> mFences;
+    UploadRingStats mStats;
+};
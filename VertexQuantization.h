@@ -0,0 +1,87 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <stdint.h>
+#include <vector>
+
+#include "IndexedMesh.h"
+
+// Compact 16-byte vertex (half of MeshVertex):
+//  - position: 16-bit unorm per axis, relative to the mesh AABB. The shader
+//    reads [0,1] and the dequantization (translate to aabbMin, scale by the
+//    extent) is folded into the model matrix, see dequantizationMatrix().
+//  - normal: octahedral encoding in two 16-bit snorm values.
+//  - uv: two half floats.
+struct QuantizedVertex
+{
+    uint16_t position[4]; // xyz + padding
+    int16_t normal[2];
+    uint16_t uv[2];
+};
+static_assert(sizeof(QuantizedVertex) == 16, "QuantizedVertex must stay 16 bytes");
+
+// Maps a unit vector onto the [-1,1]^2 octahedron parameterization.
+inline glm::vec2 octEncode(glm::vec3 n)
+{
+    n /= (glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z));
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        p = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return p;
+}
+
+// Inverse of octEncode; mirrors octDecode() in the scene vertex shader.
+inline glm::vec3 octDecode(glm::vec2 p)
+{
+    glm::vec3 n(p.x, p.y, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+    float t = glm::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+// AABB extent with degenerate (flat) axes widened so the dequantization
+// matrix stays invertible.
+inline glm::vec3 quantizationExtent(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    return glm::max(boundsMax - boundsMin, glm::vec3(1e-6f));
+}
+
+// Object-space transform from quantized [0,1] positions back to the mesh.
+inline glm::mat4 dequantizationMatrix(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    glm::vec3 extent = quantizationExtent(boundsMin, boundsMax);
+    glm::mat4 m(1.0f);
+    m[0][0] = extent.x;
+    m[1][1] = extent.y;
+    m[2][2] = extent.z;
+    m[3] = glm::vec4(boundsMin, 1.0f);
+    return m;
+}
+
+inline void quantizeVertices(const std::vector<MeshVertex> &vertices, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, std::vector<QuantizedVertex> &out)
+{
+    const glm::vec3 scale = 1.0f / quantizationExtent(boundsMin, boundsMax);
+    out.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const MeshVertex &v = vertices[i];
+        QuantizedVertex &q = out[i];
+        glm::vec3 p = (v.position - boundsMin) * scale;
+        q.position[0] = glm::packUnorm1x16(p.x);
+        q.position[1] = glm::packUnorm1x16(p.y);
+        q.position[2] = glm::packUnorm1x16(p.z);
+        q.position[3] = 0;
+
+        float len = glm::length(v.normal);
+        glm::vec2 oct = len > 0.0f ? octEncode(v.normal / len) : glm::vec2(0.0f);
+        q.normal[0] = (int16_t)glm::packSnorm1x16(oct.x);
+        q.normal[1] = (int16_t)glm::packSnorm1x16(oct.y);
+
+        q.uv[0] = glm::packHalf1x16(v.uv.x);
+        q.uv[1] = glm::packHalf1x16(v.uv.y);
+    }
+}